@@ -0,0 +1,289 @@
+#include "ofApp.h"
+
+// Counts every heap allocation made by the process
+static std::atomic<uint64_t> numAllocations(0);
+
+void * operator new(size_t size) {
+	numAllocations++;
+	void * p = malloc(size);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void * p) noexcept {
+	free(p);
+}
+
+// Builds one widget packet, the way the widget would send it to the host
+static void appendPacket(vector<uint8_t> & bytes, uint8_t label, const uint8_t * data, size_t length) {
+	bytes.push_back(0x7E);
+	bytes.push_back(label);
+	bytes.push_back(length & 0xFF);
+	bytes.push_back((length >> 8) & 0xFF);
+	bytes.insert(bytes.end(), data, data + length);
+	bytes.push_back(0xE7);
+}
+
+//--------------------------------------------------------------
+void ofApp::setup(){
+
+	ofSetLogLevel(OF_LOG_NOTICE);
+
+	benchmarkSendDmx();
+	benchmarkTransform();
+	benchmarkParse();
+	benchmarkChangeOfState();
+	benchmarkRdmMessage();
+	benchmarkRdmDecodeUid();
+	benchmarkDiscovery(1);
+	benchmarkDiscovery(10);
+	benchmarkDiscovery(100);
+	benchmarkDiscovery(1000);
+
+	saveResults(ofToDataPath("benchmark.json"));
+	ofExit();
+}
+
+//--------------------------------------------------------------
+void ofApp::update(){
+
+}
+
+//--------------------------------------------------------------
+void ofApp::draw(){
+
+}
+
+//--------------------------------------------------------------
+void ofApp::benchmarkSendDmx() {
+	const int numFrames = 100000;
+	uint8_t channels[512];
+
+	// Without a port this measures the host side cost of building frames
+	BenchmarkDmxUsbPro memory;
+	// writeFrame() does the sending, sendDmx() only sets the universe
+	memory.setDmxBatching(true);
+	uint64_t allocations = numAllocations;
+	uint64_t start = ofGetElapsedTimeMicros();
+	for (int i=0; i<numFrames; i++) {
+		memset(channels, i & 0xFF, sizeof(channels));
+		memory.sendDmx(channels, sizeof(channels));
+		memory.writeFrame();
+	}
+	uint64_t time = ofGetElapsedTimeMicros() - start;
+	addResult("send_dmx_memory", numFrames * 1e6 / time, "frames/s");
+	addResult("send_dmx_memory_allocations", (double)(numAllocations - allocations) / numFrames, "allocations/frame");
+
+#ifndef TARGET_WIN32
+	DmxUsbProSimulator simulator;
+	if (!simulator.open())
+		return;
+	BenchmarkDmxUsbPro dmx;
+	if (!dmx.setup(simulator.getPortName()))
+		return;
+	dmx.setStatsEnabled(true);
+	dmx.setDmxBatching(true);
+
+	const int numSimulatorFrames = 2000;
+	allocations = numAllocations;
+	start = ofGetElapsedTimeMicros();
+	for (int i=0; i<numSimulatorFrames; i++) {
+		memset(channels, i & 0xFF, sizeof(channels));
+		dmx.sendDmx(channels, sizeof(channels));
+		dmx.writeFrame();
+	}
+	time = ofGetElapsedTimeMicros() - start;
+	// Frames that actually went to the port
+	uint64_t framesSent = dmx.getStats().framesSent;
+	addResult("send_dmx_simulator", framesSent * 1e6 / time, "frames/s");
+	addResult("send_dmx_simulator_allocations", (double)(numAllocations - allocations) / MAX(framesSent, 1), "allocations/frame");
+	if (framesSent != numSimulatorFrames)
+		ofLogError("benchmark") << "Sent " << framesSent << " of " << numSimulatorFrames << " frames";
+#endif
+}
+
+//--------------------------------------------------------------
+void ofApp::benchmarkTransform() {
+	// A linear 16-bit pair has to pass every value through unchanged
+	DmxTransform linear;
+	linear.set16Bit(0);
+	linear.setCurve(2, 1, DMX_CURVE_SQUARE);
+	uint64_t mismatches = 0;
+	for (uint32_t v=0; v<65536; v++) {
+		uint8_t input[3] = { (uint8_t)(v >> 8), (uint8_t)(v & 0xFF), 0 };
+		uint8_t output[3];
+		linear.apply(input, output, sizeof(input));
+		if (output[0] != input[0] || output[1] != input[1])
+			mismatches++;
+	}
+	if (mismatches > 0)
+		ofLogError("benchmark") << "Linear 16-bit pair changed " << mismatches << " values";
+
+	// Curves on every channel with a few 16-bit pairs among them
+	DmxTransform transform;
+	transform.setCurve(0, 512, DMX_CURVE_S);
+	transform.set16Bit(0, 16);
+	uint8_t input[512];
+	uint8_t output[512];
+	for (int i=0; i<512; i++)
+		input[i] = i & 0xFF;
+
+	const int numFrames = 200000;
+	uint64_t start = ofGetElapsedTimeMicros();
+	for (int i=0; i<numFrames; i++) {
+		input[i & 511] = i & 0xFF;
+		transform.apply(input, output, sizeof(input));
+	}
+	uint64_t time = ofGetElapsedTimeMicros() - start;
+	addResult("transform", numFrames * 1e6 / time, "frames/s");
+}
+
+//--------------------------------------------------------------
+void ofApp::benchmarkParse() {
+	// Full universes as PACKET_RECEIVED, split into reads of odd sizes
+	uint8_t data[2 + 512];
+	memset(data, 0, sizeof(data));
+	vector<uint8_t> bytes;
+	for (int i=0; i<16; i++) {
+		data[2] = i;
+		appendPacket(bytes, 5, data, sizeof(data));
+	}
+
+	BenchmarkDmxUsbPro dmx;
+	numReceived = 0;
+	ofAddListener(dmx.dmxReceived, this, &ofApp::dmxReceived);
+
+	const int numRounds = 20000;
+	const size_t readSize = 1000;
+	uint64_t allocations = numAllocations;
+	uint64_t start = ofGetElapsedTimeMicros();
+	for (int i=0; i<numRounds; i++) {
+		for (size_t offset=0; offset<bytes.size(); offset+=readSize) {
+			dmx.receive(bytes.data() + offset, MIN(readSize, bytes.size() - offset));
+			dmx.update();
+		}
+	}
+	uint64_t time = ofGetElapsedTimeMicros() - start;
+	addResult("parse_packets", numReceived * 1e6 / time, "packets/s");
+	addResult("parse_bytes", (double)bytes.size() * numRounds / time, "MB/s");
+	addResult("parse_allocations", (double)(numAllocations - allocations) / MAX(numReceived, 1), "allocations/packet");
+
+	ofRemoveListener(dmx.dmxReceived, this, &ofApp::dmxReceived);
+}
+
+//--------------------------------------------------------------
+void ofApp::benchmarkChangeOfState() {
+	// Every block of 40 channels with every other channel changed
+	vector<uint8_t> bytes;
+	for (int block=0; block<13; block++) {
+		uint8_t data[6 + 40];
+		data[0] = block * 5;
+		memset(data + 1, 0x55, 5);
+		memset(data + 6, block, 20);
+		appendPacket(bytes, 9, data, 6 + 20);
+	}
+
+	BenchmarkDmxUsbPro dmx;
+	numReceived = 0;
+	ofAddListener(dmx.dmxReceived, this, &ofApp::dmxReceived);
+
+	const int numRounds = 50000;
+	uint64_t start = ofGetElapsedTimeMicros();
+	for (int i=0; i<numRounds; i++) {
+		dmx.receive(bytes.data(), bytes.size());
+		dmx.update();
+	}
+	uint64_t time = ofGetElapsedTimeMicros() - start;
+	addResult("change_of_state_packets", numReceived * 1e6 / time, "packets/s");
+
+	ofRemoveListener(dmx.dmxReceived, this, &ofApp::dmxReceived);
+}
+
+//--------------------------------------------------------------
+void ofApp::benchmarkRdmMessage() {
+	const int numMessages = 200000;
+	RdmUid uid = RdmUidFromString("7FF000000001");
+	uint64_t valid = 0;
+
+	uint64_t allocations = numAllocations;
+	uint64_t start = ofGetElapsedTimeMicros();
+	for (int i=0; i<numMessages; i++) {
+		RdmMessage msg(uid, GET_COMMAND, DEVICE_INFO);
+		msg.setTransactionNumber(i);
+		msg.updateChecksum();
+		valid += msg.validateChecksum() ? 1 : 0;
+	}
+	uint64_t time = ofGetElapsedTimeMicros() - start;
+	addResult("rdm_message", numMessages * 1e6 / time, "messages/s");
+	addResult("rdm_message_allocations", (double)(numAllocations - allocations) / numMessages, "allocations/message");
+	if (valid != numMessages)
+		ofLogError("benchmark") << "RdmMessage checksum mismatch";
+}
+
+//--------------------------------------------------------------
+void ofApp::benchmarkRdmDecodeUid() {
+	uint8_t euid[24];
+	RdmEncodeUid(RdmUidFromString("7FF012345678"), euid);
+
+	const int numDecodes = 1000000;
+	uint64_t valid = 0;
+	uint64_t start = ofGetElapsedTimeMicros();
+	for (int i=0; i<numDecodes; i++) {
+		RdmUid uid;
+		euid[9] = 0xAA | (i & 0x55);
+		euid[10] = 0x55 | (i & 0xAA);
+		valid += RdmDecodeUid(euid, sizeof(euid), uid) ? 1 : 0;
+	}
+	uint64_t time = ofGetElapsedTimeMicros() - start;
+	addResult("rdm_decode_uid", numDecodes * 1e6 / time, "decodes/s");
+	ofLogVerbose("benchmark") << valid << " valid UIDs";
+}
+
+//--------------------------------------------------------------
+void ofApp::benchmarkDiscovery(size_t numResponders) {
+#ifndef TARGET_WIN32
+	DmxUsbProSimulator simulator;
+	simulator.addResponders(numResponders);
+	if (!simulator.open())
+		return;
+	ofxDmxUsbPro dmx;
+	if (!dmx.setup(simulator.getPortName()))
+		return;
+	// The simulator answers right away, so empty branches can time out quickly
+	dmx.setRdmDiscoveryTimeout(5000);
+
+	vector<RdmUid> uids;
+	uint64_t start = ofGetElapsedTimeMicros();
+	dmx.getRdmDiscoveryFull(uids);
+	uint64_t time = ofGetElapsedTimeMicros() - start;
+
+	string name = "discovery_" + ofToString(numResponders);
+	addResult(name, time / 1000.0, "ms");
+	addResult(name + "_found", uids.size(), "devices");
+	addResult(name + "_requests", simulator.getNumDiscoveryRequests(), "requests");
+#endif
+}
+
+//--------------------------------------------------------------
+void ofApp::addResult(string name, double value, string unit) {
+	ofLogNotice("benchmark") << name << ": " << value << " " << unit;
+	results.push_back({ name, value, unit });
+}
+
+//--------------------------------------------------------------
+void ofApp::saveResults(string path) {
+	ofstream file(path.c_str());
+	file << "{\n\t\"benchmarks\": [\n";
+	for (size_t i=0; i<results.size(); i++) {
+		file << "\t\t{ \"name\": \"" << results[i].name << "\", \"value\": " << results[i].value << ", \"unit\": \"" << results[i].unit << "\" }";
+		file << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	file << "\t]\n}\n";
+	ofLogNotice("benchmark") << "Results written to " << path;
+}
+
+//--------------------------------------------------------------
+void ofApp::dmxReceived(ofxDmxUsbPro::DmxData & data) {
+	numReceived++;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxDmxUsbPro.h"
+#include "DmxUsbProSimulator.h"
+
+// Gives the benchmark access to the parser so packets can be fed from memory,
+// and to the frame writer
+class BenchmarkDmxUsbPro : public ofxDmxUsbPro {
+public:
+	void receive(const uint8_t * bytes, size_t size) {
+		parser.write(bytes, size);
+	}
+
+	// Builds a frame from the universe and writes it like the output thread
+	// does. flushDmx() would hold back frames faster than the line rate.
+	void writeFrame() {
+		writeDmxFrame(frame);
+		writeBytes(frame.packet, frame.size);
+	}
+
+	DmxFrame frame;
+};
+
+class ofApp : public ofBaseApp{
+
+	public:
+		void setup();
+		void update();
+		void draw();
+
+		void benchmarkSendDmx();
+		void benchmarkTransform();
+		void benchmarkParse();
+		void benchmarkChangeOfState();
+		void benchmarkRdmMessage();
+		void benchmarkRdmDecodeUid();
+		void benchmarkDiscovery(size_t numResponders);
+
+		void addResult(string name, double value, string unit);
+		void saveResults(string path);
+
+		void dmxReceived(ofxDmxUsbPro::DmxData & data);
+
+		typedef struct {
+			string	name;
+			double	value;
+			string	unit;
+		} Result;
+
+		vector<Result> results;
+		uint64_t numReceived;
+};
@@ -16,6 +16,7 @@ void ofApp::update(){
 		channels[i] = (unsigned char)ofGetFrameNum();
 
 	dmxpro.sendDmx(channels, 24);
+	dmxpro.update();
 }
 
 //--------------------------------------------------------------
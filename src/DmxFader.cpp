@@ -0,0 +1,131 @@
+#include "DmxFader.h"
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DMX_FADE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DMX_FADE_NEON
+#endif
+
+DmxFader::DmxFader() {
+	clear();
+}
+
+void DmxFader::fade(const uint8_t * values, size_t count, uint16_t channel, uint8_t * universe, uint64_t fadeMicros, uint64_t micros) {
+	if (channel >= 512 || count == 0)
+		return;
+	count = std::min(count, (size_t)(512 - channel));
+
+	uint16_t low, high;
+	update(micros, universe, low, high);
+	lastMicros = micros;
+	extend(channel, channel + count, universe);
+
+	float r = fadeMicros > 0 ? 1.f / fadeMicros : 0;
+	for (size_t i=channel; i<channel + count; i++) {
+		from[i] = universe[i];
+		delta[i] = (float)values[i - channel] - universe[i];
+		progress[i] = fadeMicros > 0 ? 0 : 1;
+		rate[i] = r;
+	}
+}
+
+void DmxFader::stop(uint16_t channel, size_t count, const uint8_t * universe) {
+	size_t low = std::max(channel, activeLow);
+	size_t high = std::min((size_t)channel + count, (size_t)activeHigh);
+	for (size_t i=low; i<high; i++) {
+		from[i] = universe[i];
+		delta[i] = 0;
+		progress[i] = 1;
+		rate[i] = 0;
+	}
+}
+
+void DmxFader::clear() {
+	activeLow = 512;
+	activeHigh = 0;
+	lastMicros = 0;
+}
+
+bool DmxFader::isActive() const {
+	return activeLow < activeHigh;
+}
+
+bool DmxFader::update(uint64_t micros, uint8_t * universe, uint16_t & low, uint16_t & high) {
+	if (!isActive())
+		return false;
+	float dt = micros > lastMicros ? (float)(micros - lastMicros) : 0;
+	lastMicros = micros;
+
+	size_t i = activeLow;
+	float remaining = 1;
+#if defined(DMX_FADE_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	__m128 one = _mm_set1_ps(1);
+	__m128 step = _mm_set1_ps(dt);
+	__m128 least = one;
+	for (; i<activeHigh; i+=4) {
+		__m128 p = _mm_min_ps(_mm_add_ps(_mm_load_ps(progress + i), _mm_mul_ps(_mm_load_ps(rate + i), step)), one);
+		_mm_store_ps(progress + i, p);
+		least = _mm_min_ps(least, p);
+		__m128i v = _mm_cvtps_epi32(_mm_add_ps(_mm_load_ps(from + i), _mm_mul_ps(_mm_load_ps(delta + i), p)));
+		v = _mm_packus_epi16(_mm_packs_epi32(v, zero), zero);
+		int32_t packed = _mm_cvtsi128_si32(v);
+		memcpy(universe + i, &packed, 4);
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, least);
+	remaining = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+#elif defined(DMX_FADE_NEON)
+	float32x4_t one = vdupq_n_f32(1);
+	float32x4_t step = vdupq_n_f32(dt);
+	float32x4_t least = one;
+	for (; i<activeHigh; i+=4) {
+		float32x4_t p = vminq_f32(vmlaq_f32(vld1q_f32(progress + i), vld1q_f32(rate + i), step), one);
+		vst1q_f32(progress + i, p);
+		least = vminq_f32(least, p);
+		uint32x4_t v = vcvtq_u32_f32(vaddq_f32(vmlaq_f32(vld1q_f32(from + i), vld1q_f32(delta + i), p), vdupq_n_f32(0.5f)));
+		uint8x8_t b = vqmovn_u16(vcombine_u16(vqmovn_u32(v), vdup_n_u16(0)));
+		uint32_t packed = vget_lane_u32(vreinterpret_u32_u8(b), 0);
+		memcpy(universe + i, &packed, 4);
+	}
+	float lanes[4];
+	vst1q_f32(lanes, least);
+	remaining = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+#endif
+	for (; i<activeHigh; i++) {
+		float p = std::min(progress[i] + rate[i] * dt, 1.f);
+		progress[i] = p;
+		remaining = std::min(remaining, p);
+		float v = from[i] + delta[i] * p;
+		universe[i] = (uint8_t)std::max(0.f, std::min(v + 0.5f, 255.f));
+	}
+
+	low = activeLow;
+	high = activeHigh;
+	// Every fade has arrived, the last values are in universe
+	if (remaining >= 1)
+		clear();
+	return true;
+}
+
+void DmxFader::extend(uint16_t low, uint16_t high, const uint8_t * universe) {
+	low = low & ~3;
+	high = std::min((high + 3) & ~3, 512);
+	uint16_t newLow = isActive() ? std::min(activeLow, low) : low;
+	uint16_t newHigh = isActive() ? std::max(activeHigh, high) : high;
+	// Channels new to the range hold their current value
+	for (size_t i=newLow; i<newHigh; i++) {
+		if (i >= activeLow && i < activeHigh)
+			continue;
+		from[i] = universe[i];
+		delta[i] = 0;
+		progress[i] = 1;
+		rate[i] = 0;
+	}
+	activeLow = newLow;
+	activeHigh = newHigh;
+}
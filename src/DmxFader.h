@@ -0,0 +1,36 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Per channel fades of a universe. The state is kept as separate arrays of
+// floats so update() steps four channels at a time with SSE2 or NEON. Only
+// the range of channels covering the running fades is touched, and channels
+// inside it that are not fading hold their value.
+class DmxFader {
+public:
+	DmxFader();
+
+	// Advances the running fades to micros, then fades count channels from
+	// their value in universe to values over fadeMicros
+	void fade(const uint8_t * values, size_t count, uint16_t channel, uint8_t * universe, uint64_t fadeMicros, uint64_t micros);
+	// Ends fades on the channels, holding the values now in universe
+	void stop(uint16_t channel, size_t count, const uint8_t * universe);
+	void clear();
+	bool isActive() const;
+
+	// Writes the values at micros into universe. Returns false when nothing
+	// is fading, otherwise the channels written are [low, high).
+	bool update(uint64_t micros, uint8_t * universe, uint16_t & low, uint16_t & high);
+
+protected:
+	void extend(uint16_t low, uint16_t high, const uint8_t * universe);
+
+	alignas(16) float from[512];
+	alignas(16) float delta[512];
+	alignas(16) float progress[512];	// 0 to 1
+	alignas(16) float rate[512];		// Progress per microsecond, 0 when holding
+	uint16_t activeLow;					// Multiples of 4, empty when idle
+	uint16_t activeHigh;
+	uint64_t lastMicros;
+};
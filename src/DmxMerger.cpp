@@ -0,0 +1,315 @@
+#include "DmxMerger.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DMX_MERGE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DMX_MERGE_NEON
+#endif
+
+void DmxMergeMax(uint8_t * dst, const uint8_t * src, size_t size) {
+	size_t i = 0;
+#if defined(DMX_MERGE_SSE2)
+	for (; i+16<=size; i+=16) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_max_epu8(d, s));
+	}
+#elif defined(DMX_MERGE_NEON)
+	for (; i+16<=size; i+=16)
+		vst1q_u8(dst + i, vmaxq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+#endif
+	for (; i<size; i++)
+		dst[i] = MAX(dst[i], src[i]);
+}
+
+void DmxMergeSelect(uint8_t * dst, const uint8_t * a, const uint8_t * b, const uint8_t * mask, size_t size) {
+	size_t i = 0;
+#if defined(DMX_MERGE_SSE2)
+	for (; i+16<=size; i+=16) {
+		__m128i m = _mm_loadu_si128((const __m128i*)(mask + i));
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(m, va), _mm_andnot_si128(m, vb)));
+	}
+#elif defined(DMX_MERGE_NEON)
+	for (; i+16<=size; i+=16)
+		vst1q_u8(dst + i, vbslq_u8(vld1q_u8(mask + i), vld1q_u8(a + i), vld1q_u8(b + i)));
+#endif
+	for (; i<size; i++)
+		dst[i] = (mask[i] & a[i]) | (~mask[i] & b[i]);
+}
+
+DmxMerger::DmxMerger() {
+	output = nullptr;
+	sequence = 0;
+	dirtyLow = 512;
+	dirtyHigh = 0;
+	outputLength = 0;
+	memset(modes, DMX_MERGE_HTP, sizeof(modes));
+	memset(htpMask, 0xFF, sizeof(htpMask));
+	memset(ltpMask, 0, sizeof(ltpMask));
+	numLtpChannels = 0;
+	numPriorityChannels = 0;
+	memset(out, 0, sizeof(out));
+	memset(merged, 0, sizeof(merged));
+	memset(htp, 0, sizeof(htp));
+	memset(ltp, 0, sizeof(ltp));
+	memset(priority, 0, sizeof(priority));
+	memset(level, 0, sizeof(level));
+	memset(claimed, 0, sizeof(claimed));
+	memset(covered, 0, sizeof(covered));
+}
+
+void DmxMerger::setOutput(ofxDmxUsbPro & dmx) {
+	output = &dmx;
+}
+
+void DmxMerger::addSource(const string & name, uint8_t priority, uint64_t timeoutMillis) {
+	ofScopedLock lock(mutex);
+	if (!findSource(name))
+		createSource(name, priority, timeoutMillis);
+}
+
+DmxMerger::Source * DmxMerger::createSource(const string & name, uint8_t priority, uint64_t timeoutMillis) {
+	// Called with mutex locked
+	unique_ptr<Source> source(new Source());
+	source->name = name;
+	source->priority = priority;
+	source->timeoutMicros = timeoutMillis * 1000;
+	source->lastUpdate = 0;
+	source->active = false;
+	source->length = 0;
+	memset(source->data, 0, sizeof(source->data));
+	memset(source->changed, 0, sizeof(source->changed));
+	sources.push_back(std::move(source));
+	return sources.back().get();
+}
+
+void DmxMerger::removeSource(const string & name) {
+	ofScopedLock lock(mutex);
+	for (size_t i=0; i<sources.size(); i++) {
+		if (sources[i]->name == name) {
+			if (sources[i]->active)
+				markDirty(0, sources[i]->length);
+			sources.erase(sources.begin() + i);
+			return;
+		}
+	}
+}
+
+bool DmxMerger::hasSource(const string & name) {
+	ofScopedLock lock(mutex);
+	return findSource(name) != nullptr;
+}
+
+bool DmxMerger::isSourceActive(const string & name) {
+	ofScopedLock lock(mutex);
+	Source * source = findSource(name);
+	return source && source->active;
+}
+
+void DmxMerger::setSourcePriority(const string & name, uint8_t priority) {
+	ofScopedLock lock(mutex);
+	Source * source = findSource(name);
+	if (source && source->priority != priority) {
+		source->priority = priority;
+		markDirty(0, source->length);
+	}
+}
+
+void DmxMerger::setSourceTimeout(const string & name, uint64_t timeoutMillis) {
+	ofScopedLock lock(mutex);
+	Source * source = findSource(name);
+	if (source)
+		source->timeoutMicros = timeoutMillis * 1000;
+}
+
+void DmxMerger::setSource(const string & name, const uint8_t * dmx, size_t length, uint16_t channel) {
+	if (channel >= 512)
+		return;
+	if (channel + length > 512)
+		length = 512 - channel;
+
+	// Found or created under the same lock, so a removeSource() from another
+	// thread cannot get in between
+	ofScopedLock lock(mutex);
+	Source * source = findSource(name);
+	if (!source)
+		source = createSource(name, 100, 0);
+	source->lastUpdate = ofGetElapsedTimeMicros();
+	if (!source->active) {
+		source->active = true;
+		markDirty(0, source->length);
+	}
+
+	// Only channels that really changed take part in the next merge
+	sequence++;
+	size_t low = 512;
+	size_t high = 0;
+	for (size_t i=0; i<length; i++) {
+		size_t c = channel + i;
+		if (source->data[c] != dmx[i]) {
+			source->data[c] = dmx[i];
+			source->changed[c] = sequence;
+			low = MIN(low, c);
+			high = c + 1;
+		}
+	}
+	if (channel + length > source->length) {
+		// Newly covered channels count as changed even when they are zero
+		for (size_t c=source->length; c<channel+length; c++)
+			source->changed[c] = sequence;
+		low = MIN(low, (size_t)source->length);
+		high = MAX(high, channel + length);
+		source->length = channel + length;
+	}
+	markDirty(low, high);
+}
+
+void DmxMerger::setChannelMode(uint16_t channel, DmxMergeMode mode) {
+	setChannelMode(channel, 1, mode);
+}
+
+void DmxMerger::setChannelMode(uint16_t channel, size_t count, DmxMergeMode mode) {
+	ofScopedLock lock(mutex);
+	for (size_t c=channel; c<channel+count && c<512; c++) {
+		if (modes[c] == DMX_MERGE_LTP)
+			numLtpChannels--;
+		if (modes[c] == DMX_MERGE_PRIORITY)
+			numPriorityChannels--;
+		modes[c] = mode;
+		htpMask[c] = mode == DMX_MERGE_HTP ? 0xFF : 0x00;
+		ltpMask[c] = mode == DMX_MERGE_LTP ? 0xFF : 0x00;
+		if (mode == DMX_MERGE_LTP)
+			numLtpChannels++;
+		if (mode == DMX_MERGE_PRIORITY)
+			numPriorityChannels++;
+	}
+	markDirty(channel, MIN(channel + count, (size_t)512));
+}
+
+DmxMergeMode DmxMerger::getChannelMode(uint16_t channel) {
+	return channel < 512 ? (DmxMergeMode)modes[channel] : DMX_MERGE_HTP;
+}
+
+bool DmxMerger::update() {
+	ofScopedLock lock(mutex);
+
+	// Sources that timed out leave the merge, their channels fall back
+	uint64_t now = ofGetElapsedTimeMicros();
+	uint16_t length = 0;
+	for (unique_ptr<Source> & source : sources) {
+		bool active = source->length > 0 && (source->timeoutMicros == 0 || now - source->lastUpdate < source->timeoutMicros);
+		if (active != source->active) {
+			source->active = active;
+			markDirty(0, source->length);
+		}
+		if (source->active)
+			length = MAX(length, source->length);
+	}
+	// Channels a shrinking output gives up still have to go out once as
+	// zeros, the widget keeps sending its universe as it is
+	size_t sendLength = MAX(length, outputLength);
+	if (length != outputLength) {
+		markDirty(MIN(length, outputLength), MAX(length, outputLength));
+		outputLength = length;
+	}
+	if (dirtyLow >= dirtyHigh)
+		return false;
+
+	// Whole vectors are as cheap as single channels
+	size_t low = dirtyLow & ~15;
+	size_t high = MIN((dirtyHigh + 15) & ~15, 512);
+	dirtyLow = 512;
+	dirtyHigh = 0;
+	merge(low, high);
+
+	if (memcmp(out + low, merged + low, high - low) == 0)
+		return false;
+	memcpy(out + low, merged + low, high - low);
+	if (output && low < sendLength)
+		output->sendDmx(out + low, MIN(high, sendLength) - low, low);
+	return true;
+}
+
+const uint8_t * DmxMerger::getOutput() {
+	return out;
+}
+
+size_t DmxMerger::getLength() {
+	return outputLength;
+}
+
+DmxMerger::Source * DmxMerger::findSource(const string & name) {
+	for (unique_ptr<Source> & source : sources)
+		if (source->name == name)
+			return source.get();
+	return nullptr;
+}
+
+void DmxMerger::markDirty(size_t low, size_t high) {
+	if (low >= high)
+		return;
+	dirtyLow = MIN(dirtyLow, low);
+	dirtyHigh = MAX(dirtyHigh, MIN(high, (size_t)512));
+}
+
+void DmxMerger::merge(size_t low, size_t high) {
+	size_t size = high - low;
+	vector<Source*> active;
+	active.reserve(sources.size());
+	for (unique_ptr<Source> & source : sources)
+		if (source->active)
+			active.push_back(source.get());
+
+	// HTP over every source. Inactive channels of a source are zero.
+	memset(htp + low, 0, size);
+	for (Source * source : active)
+		DmxMergeMax(htp + low, source->data + low, size);
+
+	// Priority goes level by level from the highest, a level only gets the
+	// channels no higher level covers
+	if (numPriorityChannels > 0) {
+		sort(active.begin(), active.end(), [](const Source * a, const Source * b) {
+			return a->priority > b->priority;
+		});
+		memset(priority + low, 0, size);
+		memset(claimed + low, 0, size);
+		for (size_t i=0; i<active.size();) {
+			memset(level + low, 0, size);
+			memset(covered + low, 0, size);
+			size_t j = i;
+			for (; j<active.size() && active[j]->priority == active[i]->priority; j++) {
+				DmxMergeMax(level + low, active[j]->data + low, size);
+				if (active[j]->length > low)
+					memset(covered + low, 0xFF, MIN((size_t)active[j]->length, high) - low);
+			}
+			DmxMergeSelect(priority + low, priority + low, level + low, claimed + low, size);
+			DmxMergeMax(claimed + low, covered + low, size);
+			i = j;
+		}
+	}
+
+	// LTP needs the most recent change per channel, which does not vectorise
+	// as nicely and is usually only used on a few channels
+	if (numLtpChannels > 0) {
+		for (size_t c=low; c<high; c++) {
+			if (!ltpMask[c])
+				continue;
+			uint32_t latest = 0;
+			ltp[c] = 0;
+			for (Source * source : active) {
+				if (c < source->length && source->changed[c] >= latest) {
+					latest = source->changed[c];
+					ltp[c] = source->data[c];
+				}
+			}
+		}
+	}
+
+	// Pick the result of each channel's mode
+	DmxMergeSelect(merged + low, ltp + low, priority + low, ltpMask + low, size);
+	DmxMergeSelect(merged + low, htp + low, merged + low, htpMask + low, size);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxDmxUsbPro.h"
+
+typedef enum {
+	DMX_MERGE_HTP,		// Highest value of all sources
+	DMX_MERGE_LTP,		// Value of the source that changed the channel last
+	DMX_MERGE_PRIORITY	// Highest value among the sources with the highest priority
+} DmxMergeMode;
+
+// dst[i] = max(dst[i], src[i])
+void DmxMergeMax(uint8_t * dst, const uint8_t * src, size_t size);
+// dst[i] = mask[i] ? a[i] : b[i], mask bytes must be 0x00 or 0xFF
+void DmxMergeSelect(uint8_t * dst, const uint8_t * a, const uint8_t * b, const uint8_t * mask, size_t size);
+
+// Merges the universes of several named sources into one output universe.
+// Every channel has a merge mode, HTP by default. Sources only cover the
+// channels up to the highest one they have set, and drop out of the merge
+// when they have not been updated within their timeout.
+//
+// Sources can be set from any thread. update() merges the channels that
+// changed since the previous update and sends them to the output.
+class DmxMerger {
+public:
+	DmxMerger();
+
+	void setOutput(ofxDmxUsbPro & dmx);
+
+	void addSource(const string & name, uint8_t priority = 100, uint64_t timeoutMillis = 0);
+	void removeSource(const string & name);
+	bool hasSource(const string & name);
+	bool isSourceActive(const string & name);
+	void setSourcePriority(const string & name, uint8_t priority);
+	void setSourceTimeout(const string & name, uint64_t timeoutMillis);
+	// Adds the source with default settings if it does not exist
+	void setSource(const string & name, const uint8_t * dmx, size_t length, uint16_t channel = 0);
+
+	void setChannelMode(uint16_t channel, DmxMergeMode mode);
+	void setChannelMode(uint16_t channel, size_t count, DmxMergeMode mode);
+	DmxMergeMode getChannelMode(uint16_t channel);
+
+	// Returns true when the output changed
+	bool update();
+	const uint8_t * getOutput();
+	size_t getLength();
+
+protected:
+	typedef struct {
+		string		name;
+		uint8_t		priority;
+		uint64_t	timeoutMicros;
+		uint64_t	lastUpdate;
+		bool		active;
+		uint16_t	length;
+		uint8_t		data[512];		// Zero beyond length
+		uint32_t	changed[512];	// When each channel last changed, for LTP
+	} Source;
+
+	Source * findSource(const string & name);
+	Source * createSource(const string & name, uint8_t priority, uint64_t timeoutMillis);
+	void markDirty(size_t low, size_t high);
+	void merge(size_t low, size_t high);
+
+	ofxDmxUsbPro * output;
+	ofMutex mutex;
+	vector<unique_ptr<Source>> sources;
+	uint32_t sequence;
+	uint16_t dirtyLow;
+	uint16_t dirtyHigh;
+
+	// Per channel masks, 0xFF where the channel uses the mode
+	uint8_t modes[512];
+	uint8_t htpMask[512];
+	uint8_t ltpMask[512];
+	size_t numLtpChannels;
+	size_t numPriorityChannels;
+	uint16_t outputLength;
+	uint8_t out[512];
+	uint8_t merged[512];
+
+	// Scratch universes of the merge
+	uint8_t htp[512];
+	uint8_t ltp[512];
+	uint8_t priority[512];
+	uint8_t level[512];
+	uint8_t claimed[512];
+	uint8_t covered[512];
+};
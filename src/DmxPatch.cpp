@@ -0,0 +1,60 @@
+#include "DmxPatch.h"
+#include <string.h>
+
+DmxPatch::DmxPatch() {
+	clear();
+}
+
+void DmxPatch::add(uint16_t input, uint16_t output, uint16_t count, bool invert) {
+	for (size_t i=0; i<count && input + i < 512 && output + i < 512; i++) {
+		source[output + i] = input + i;
+		this->invert[output + i] = invert ? 0xFF : 0;
+	}
+	updateLength();
+}
+
+void DmxPatch::addThrough(uint16_t count) {
+	add(0, 0, count);
+}
+
+void DmxPatch::remove(uint16_t output, uint16_t count) {
+	for (size_t i=output; i<(size_t)output + count && i < 512; i++) {
+		source[i] = DMX_PATCH_NONE;
+		invert[i] = 0;
+	}
+	updateLength();
+}
+
+void DmxPatch::clear() {
+	for (size_t i=0; i<512; i++)
+		source[i] = DMX_PATCH_NONE;
+	memset(invert, 0, sizeof(invert));
+	length = 0;
+}
+
+int DmxPatch::getSource(uint16_t output) const {
+	if (output >= 512 || source[output] == DMX_PATCH_NONE)
+		return -1;
+	return source[output];
+}
+
+bool DmxPatch::isInverted(uint16_t output) const {
+	return output < 512 && invert[output] != 0;
+}
+
+size_t DmxPatch::getLength() const {
+	return length;
+}
+
+void DmxPatch::apply(const uint8_t * input, uint8_t * output) const {
+	for (size_t i=0; i<length; i++) {
+		uint16_t s = source[i];
+		output[i] = s != DMX_PATCH_NONE ? input[s] ^ invert[i] : 0;
+	}
+}
+
+void DmxPatch::updateLength() {
+	length = 512;
+	while (length > 0 && source[length - 1] == DMX_PATCH_NONE)
+		length--;
+}
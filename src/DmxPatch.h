@@ -0,0 +1,40 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define DMX_PATCH_NONE			0xFFFF
+
+// Maps the channels of an input universe to an output universe. Every output
+// channel has at most one source channel, optionally inverted, so a patch is
+// compiled into a flat table and applying it is a single pass over the output.
+// Patching one input channel to several outputs splits it, patching a range
+// to another start channel offsets it.
+class DmxPatch {
+public:
+	DmxPatch();
+
+	// Sends count input channels starting at input to the output channels
+	// starting at output, replacing what was patched there before
+	void add(uint16_t input, uint16_t output, uint16_t count = 1, bool invert = false);
+	// Every channel to the same channel
+	void addThrough(uint16_t count = 512);
+	void remove(uint16_t output, uint16_t count = 1);
+	void clear();
+
+	// Input channel patched to the output channel, or -1
+	int getSource(uint16_t output) const;
+	bool isInverted(uint16_t output) const;
+	// Length of the output universe, up to the highest patched channel
+	size_t getLength() const;
+
+	// Fills getLength() output channels, unpatched channels are 0
+	void apply(const uint8_t * input, uint8_t * output) const;
+
+protected:
+	void updateLength();
+
+	uint16_t source[512];	// Input channel, DMX_PATCH_NONE when unpatched
+	uint8_t invert[512];	// 0xFF where the value is inverted
+	uint16_t length;
+};
@@ -0,0 +1,307 @@
+#include "DmxPlayer.h"
+
+// Sleep until shortly before a frame is due and spin for the rest
+#define SPIN_MICROS 500
+
+DmxPlayer::DmxPlayer() {
+	data = nullptr;
+	dataEnd = 0;
+	memset(&header, 0, sizeof(header));
+	output = nullptr;
+	loop = false;
+	catchUpLimit = 100000;
+	offset = 0;
+	position = 0;
+	memset(universe, 0, sizeof(universe));
+	channels = 0;
+	numSkipped = 0;
+}
+
+DmxPlayer::~DmxPlayer() {
+	close();
+}
+
+bool DmxPlayer::load(string path) {
+	close();
+	if (!file.open(ofToDataPath(path), false)) {
+		ofLogError("DmxPlayer") << "Could not open " << path;
+		return false;
+	}
+	uint64_t size = file.getSize();
+	if (size >= sizeof(DmxShowHeader))
+		data = file.map(0, size);
+	if (data == nullptr) {
+		ofLogError("DmxPlayer") << path << " is empty";
+		close();
+		return false;
+	}
+
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, DMX_SHOW_MAGIC, sizeof(DMX_SHOW_MAGIC)) != 0 || header.version != DMX_SHOW_VERSION) {
+		ofLogError("DmxPlayer") << path << " is not a show file";
+		close();
+		return false;
+	}
+
+	if (!buildIndex()) {
+		ofLogError("DmxPlayer") << path << " has no frames";
+		close();
+		return false;
+	}
+	seekTo(0);
+	return true;
+}
+
+void DmxPlayer::close() {
+	stop();
+	file.close();
+	data = nullptr;
+	dataEnd = 0;
+	index.clear();
+	position = 0;
+}
+
+bool DmxPlayer::isLoaded() {
+	return data != nullptr;
+}
+
+void DmxPlayer::setOutput(ofxDmxUsbPro & dmx) {
+	output = &dmx;
+}
+
+void DmxPlayer::setLoop(bool l) {
+	loop = l;
+}
+
+void DmxPlayer::setCatchUpLimit(uint64_t micros) {
+	catchUpLimit = micros;
+}
+
+void DmxPlayer::play() {
+	if (!isLoaded() || isThreadRunning())
+		return;
+	if (offset >= dataEnd)
+		seekTo(0);
+	startThread();
+}
+
+void DmxPlayer::stop() {
+	if (isThreadRunning())
+		waitForThread(true);
+}
+
+bool DmxPlayer::isPlaying() {
+	return isThreadRunning();
+}
+
+void DmxPlayer::seek(uint64_t micros) {
+	bool playing = isPlaying();
+	stop();
+	seekTo(micros);
+	if (playing)
+		play();
+}
+
+uint64_t DmxPlayer::getPosition() {
+	return position;
+}
+
+uint64_t DmxPlayer::getDuration() {
+	return header.duration;
+}
+
+uint64_t DmxPlayer::getNumFrames() {
+	return header.numFrames;
+}
+
+void DmxPlayer::getUniverse(uint8_t * dmx, size_t size) {
+	memcpy(dmx, universe, MIN(size, 512));
+}
+
+DmxUsbProHistogram DmxPlayer::getTimingError() {
+	ofScopedLock lock(statsMutex);
+	return timingError;
+}
+
+uint64_t DmxPlayer::getNumSkipped() {
+	return numSkipped;
+}
+
+void DmxPlayer::resetTimingError() {
+	ofScopedLock lock(statsMutex);
+	timingError.clear();
+	numSkipped = 0;
+}
+
+void DmxPlayer::threadedFunction() {
+	typedef std::chrono::steady_clock clock;
+
+	// Every frame is due relative to the same start point, so sleep and send
+	// errors never accumulate
+	clock::time_point start = clock::now();
+	uint64_t startPosition = position;
+	if (output != nullptr)
+		sendUniverse();
+
+	while (isThreadRunning()) {
+		if (offset >= dataEnd) {
+			if (!loop)
+				break;
+			seekTo(0);
+			start = clock::now();
+			startPosition = 0;
+			if (output != nullptr)
+				sendUniverse();
+			continue;
+		}
+
+		DmxShowFrameHeader frame;
+		const uint8_t * frameData;
+		if (!readFrame(offset, frame, frameData)) {
+			offset = dataEnd;
+			continue;
+		}
+
+		clock::time_point due = start + std::chrono::microseconds(frame.time - MIN(frame.time, startPosition));
+		clock::time_point now = clock::now();
+		if (due - now > std::chrono::microseconds(SPIN_MICROS))
+			std::this_thread::sleep_until(due - std::chrono::microseconds(SPIN_MICROS));
+		while ((now = clock::now()) < due) {
+			if (!isThreadRunning())
+				return;
+		}
+
+		applyFrame(frame, frameData);
+		offset += sizeof(frame) + frame.size;
+		position = frame.time;
+
+		// Too far behind: apply the frames but only send the latest
+		uint64_t late = std::chrono::duration_cast<std::chrono::microseconds>(now - due).count();
+		if (late > catchUpLimit && offset < dataEnd) {
+			DmxShowFrameHeader next;
+			const uint8_t * nextData;
+			if (readFrame(offset, next, nextData) && start + std::chrono::microseconds(next.time - MIN(next.time, startPosition)) <= now) {
+				numSkipped++;
+				continue;
+			}
+		}
+
+		if (output != nullptr) {
+			// The widget is still putting the previous frame on the line, so
+			// frames that fall due until it is ready go out together with
+			// this one
+			uint64_t ready = output->getDmxReadyMicros();
+			uint64_t micros = ofGetElapsedTimeMicros();
+			clock::time_point readyTime = clock::now();
+			if (ready > micros)
+				readyTime += std::chrono::microseconds(ready - micros);
+			DmxShowFrameHeader next;
+			const uint8_t * nextData;
+			while (offset < dataEnd && readFrame(offset, next, nextData) && start + std::chrono::microseconds(next.time - MIN(next.time, startPosition)) <= readyTime) {
+				applyFrame(next, nextData);
+				offset += sizeof(next) + next.size;
+				position = next.time;
+				due = start + std::chrono::microseconds(next.time - MIN(next.time, startPosition));
+				numSkipped++;
+			}
+			sendUniverse();
+			now = clock::now();
+			late = now > due ? std::chrono::duration_cast<std::chrono::microseconds>(now - due).count() : 0;
+		}
+		ofScopedLock lock(statsMutex);
+		timingError.add(late);
+	}
+}
+
+void DmxPlayer::sendUniverse() {
+	// flushDmx() holds back a frame that comes before the widget has put the
+	// previous one on the line, so wait for it instead of leaving the frame
+	// to the app's next update()
+	uint64_t ready = output->getDmxReadyMicros();
+	uint64_t now = ofGetElapsedTimeMicros();
+	if (ready > now)
+		std::this_thread::sleep_for(std::chrono::microseconds(ready - now));
+	output->sendDmx(universe, channels);
+	output->flushDmx();
+}
+
+bool DmxPlayer::buildIndex() {
+	index.clear();
+	uint64_t size = file.getMappedSize();
+	if (header.indexOffset != 0 && header.dataEnd <= size &&
+		header.indexOffset + header.numKeyframes * sizeof(DmxShowIndexEntry) <= size) {
+		dataEnd = header.dataEnd;
+		index.resize(header.numKeyframes);
+		memcpy(index.data(), data + header.indexOffset, index.size() * sizeof(DmxShowIndexEntry));
+		return !index.empty();
+	}
+
+	// The recording was not finished, walk the frames up to the first one
+	// that is cut off
+	ofLogWarning("DmxPlayer") << "Show file has no index, scanning frames";
+	dataEnd = size;
+	uint64_t o = sizeof(DmxShowHeader);
+	header.numFrames = 0;
+	DmxShowFrameHeader frame;
+	const uint8_t * frameData;
+	while (readFrame(o, frame, frameData) && (frame.type == DMX_SHOW_KEYFRAME || !index.empty())) {
+		// The recorder grows the file in zero-filled steps, a zeroed header
+		// or a time going backwards is where the recording ends
+		if (frame.size == 0 || (header.numFrames > 0 && frame.time < header.duration))
+			break;
+		if (frame.type == DMX_SHOW_KEYFRAME)
+			index.push_back({ frame.time, o });
+		header.numFrames++;
+		header.duration = frame.time;
+		o += sizeof(frame) + frame.size;
+	}
+	dataEnd = o;
+	return !index.empty();
+}
+
+bool DmxPlayer::readFrame(uint64_t o, DmxShowFrameHeader & frame, const uint8_t *& frameData) {
+	if (o + sizeof(frame) > dataEnd)
+		return false;
+	memcpy(&frame, data + o, sizeof(frame));
+	if (frame.type > DMX_SHOW_DELTA || frame.channels > 512 || o + sizeof(frame) + frame.size > dataEnd)
+		return false;
+	if (frame.type == DMX_SHOW_KEYFRAME && frame.size != frame.channels)
+		return false;
+	frameData = data + o + sizeof(frame);
+	return true;
+}
+
+void DmxPlayer::applyFrame(const DmxShowFrameHeader & frame, const uint8_t * frameData) {
+	if (frame.type == DMX_SHOW_KEYFRAME)
+		memcpy(universe, frameData, frame.size);
+	else
+		DmxShowApplyDelta(frameData, frame.size, universe);
+	if (frame.channels < channels)
+		memset(universe + frame.channels, 0, channels - frame.channels);
+	channels = frame.channels;
+}
+
+void DmxPlayer::seekTo(uint64_t micros) {
+	if (index.empty())
+		return;
+
+	// Last keyframe at or before the position, then the deltas up to it
+	vector<DmxShowIndexEntry>::iterator it = upper_bound(index.begin(), index.end(), micros, [](uint64_t t, const DmxShowIndexEntry & entry) {
+		return t < entry.time;
+	});
+	if (it != index.begin())
+		--it;
+	offset = it->offset;
+
+	DmxShowFrameHeader frame;
+	const uint8_t * frameData;
+	memset(universe, 0, sizeof(universe));
+	channels = 0;
+	bool first = true;
+	while (readFrame(offset, frame, frameData) && (first || frame.time <= micros)) {
+		applyFrame(frame, frameData);
+		offset += sizeof(frame) + frame.size;
+		position = frame.time;
+		first = false;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxDmxUsbPro.h"
+#include "DmxShowFile.h"
+#include "DmxUsbProStats.h"
+#include <atomic>
+
+// Plays a show file to a widget.
+// The file is memory-mapped rather than loaded, frames are decoded as they
+// are due and sent from a thread that schedules every frame against a
+// monotonic clock, independent of the app frame rate. Lateness is measured
+// per frame and the player skips ahead rather than drifting when it falls
+// behind by more than the catch-up limit. Frames never go out faster than
+// the widget puts them on the line, those that fall due while it is busy
+// are merged into one.
+class DmxPlayer : protected ofThread {
+public:
+	DmxPlayer();
+	~DmxPlayer();
+
+	bool load(string path);
+	void close();
+	bool isLoaded();
+
+	void setOutput(ofxDmxUsbPro & dmx);
+	void setLoop(bool loop);
+	void setCatchUpLimit(uint64_t micros);
+
+	void play();
+	void stop();
+	bool isPlaying();
+	void seek(uint64_t micros);
+
+	uint64_t getPosition();
+	uint64_t getDuration();
+	uint64_t getNumFrames();
+	void getUniverse(uint8_t * dmx, size_t size);
+
+	// Lateness of sent frames in microseconds
+	DmxUsbProHistogram getTimingError();
+	uint64_t getNumSkipped();
+	void resetTimingError();
+
+protected:
+	void threadedFunction();
+	bool buildIndex();
+	bool readFrame(uint64_t offset, DmxShowFrameHeader & frame, const uint8_t *& data);
+	void applyFrame(const DmxShowFrameHeader & frame, const uint8_t * data);
+	void seekTo(uint64_t micros);
+	void sendUniverse();
+
+	DmxMappedFile file;
+	const uint8_t * data;
+	uint64_t dataEnd;
+	DmxShowHeader header;
+	vector<DmxShowIndexEntry> index;
+
+	ofxDmxUsbPro * output;
+	bool loop;
+	uint64_t catchUpLimit;
+
+	// Playback state, owned by the thread while playing
+	uint64_t offset;
+	std::atomic<uint64_t> position;
+	uint8_t universe[512];
+	uint16_t channels;
+
+	ofMutex statsMutex;
+	DmxUsbProHistogram timingError;
+	std::atomic<uint64_t> numSkipped;
+};
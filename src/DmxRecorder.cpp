@@ -0,0 +1,215 @@
+#include "DmxRecorder.h"
+
+// The file grows and is mapped in windows of this size
+#define WINDOW_SIZE (4 << 20)
+
+DmxRecorder::DmxRecorder() {
+	queueHead = 0;
+	queueTail = 0;
+	source = nullptr;
+	startMicros = 0;
+	numFrames = 0;
+	numDropped = 0;
+	fileSize = 0;
+	writeOffset = 0;
+	window = nullptr;
+	windowOffset = 0;
+	windowSize = 0;
+	channels = 0;
+	lastKeyframe = 0;
+}
+
+DmxRecorder::~DmxRecorder() {
+	stop();
+}
+
+bool DmxRecorder::start(string path, uint64_t keyframeIntervalMicros) {
+	// Finish a previous recording but keep listening to the widget
+	stopWriter();
+	if (!file.open(ofToDataPath(path), true)) {
+		ofLogError("DmxRecorder") << "Could not create " << path;
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DMX_SHOW_MAGIC, sizeof(DMX_SHOW_MAGIC));
+	header.version = DMX_SHOW_VERSION;
+	header.keyframeInterval = keyframeIntervalMicros;
+	index.clear();
+	fileSize = 0;
+	writeOffset = 0;
+	window = nullptr;
+	memset(universe, 0, sizeof(universe));
+	channels = 0;
+	lastKeyframe = 0;
+
+	queueHead = 0;
+	queueTail = 0;
+	numFrames = 0;
+	numDropped = 0;
+	startMicros = ofGetElapsedTimeMicros();
+	startThread();
+	return true;
+}
+
+void DmxRecorder::stop() {
+	if (source != nullptr) {
+		ofRemoveListener(source->dmxReceived, this, &DmxRecorder::dmxReceived);
+		source = nullptr;
+	}
+	stopWriter();
+}
+
+void DmxRecorder::stopWriter() {
+	if (isThreadRunning())
+		waitForThread(true);
+}
+
+bool DmxRecorder::isRecording() {
+	return isThreadRunning();
+}
+
+void DmxRecorder::listen(ofxDmxUsbPro & dmx) {
+	if (source != nullptr)
+		ofRemoveListener(source->dmxReceived, this, &DmxRecorder::dmxReceived);
+	source = &dmx;
+	ofAddListener(source->dmxReceived, this, &DmxRecorder::dmxReceived);
+}
+
+void DmxRecorder::record(const uint8_t * dmx, size_t size) {
+	if (!isThreadRunning())
+		return;
+
+	size_t head = queueHead.load(std::memory_order_relaxed);
+	if (head - queueTail.load(std::memory_order_acquire) >= DMX_RECORDER_QUEUE_SIZE) {
+		numDropped++;
+		return;
+	}
+	Frame & frame = queue[head % DMX_RECORDER_QUEUE_SIZE];
+	frame.time = ofGetElapsedTimeMicros() - startMicros;
+	frame.size = MIN(size, 512);
+	memcpy(frame.data, dmx, frame.size);
+	queueHead.store(head + 1, std::memory_order_release);
+}
+
+uint64_t DmxRecorder::getNumFrames() {
+	return numFrames;
+}
+
+uint64_t DmxRecorder::getNumDropped() {
+	return numDropped;
+}
+
+uint64_t DmxRecorder::getFileSize() {
+	return fileSize;
+}
+
+void DmxRecorder::dmxReceived(ofxDmxUsbPro::DmxData & data) {
+	record(data.data, data.size);
+}
+
+void DmxRecorder::threadedFunction() {
+	// Header up front so an unfinished recording can still be identified,
+	// it is written again with the totals when the recording stops
+	uint8_t * dst = reserve(sizeof(header));
+	if (dst != nullptr) {
+		memcpy(dst, &header, sizeof(header));
+		writeOffset += sizeof(header);
+	}
+
+	for (;;) {
+		bool running = isThreadRunning();
+		size_t tail = queueTail.load(std::memory_order_relaxed);
+		size_t head = queueHead.load(std::memory_order_acquire);
+		while (tail != head) {
+			Frame & frame = queue[tail % DMX_RECORDER_QUEUE_SIZE];
+			writeFrame(frame.time, frame.data, frame.size);
+			queueTail.store(++tail, std::memory_order_release);
+		}
+		// Drain whatever was queued before stop() and then finish the file
+		if (!running)
+			break;
+		sleep(2);
+	}
+	finish();
+}
+
+void DmxRecorder::writeFrame(uint64_t time, const uint8_t * dmx, size_t size) {
+	uint8_t delta[512];
+	size_t deltaSize = 0;
+	bool keyframe = index.empty() || size != channels || time - lastKeyframe >= header.keyframeInterval;
+	if (!keyframe) {
+		// Fall back to a keyframe when the delta is not smaller
+		keyframe = !DmxShowEncodeDelta(universe, dmx, size, delta, size, deltaSize);
+		if (!keyframe && deltaSize == 0)
+			return;
+	}
+
+	DmxShowFrameHeader frame;
+	frame.time = time;
+	frame.channels = size;
+	frame.type = keyframe ? DMX_SHOW_KEYFRAME : DMX_SHOW_DELTA;
+	frame.size = keyframe ? size : deltaSize;
+
+	uint8_t * dst = reserve(sizeof(frame) + frame.size);
+	if (dst == nullptr)
+		return;
+	memcpy(dst, &frame, sizeof(frame));
+	memcpy(dst + sizeof(frame), keyframe ? dmx : delta, frame.size);
+
+	if (keyframe) {
+		index.push_back({ time, writeOffset });
+		lastKeyframe = time;
+	}
+	writeOffset += sizeof(frame) + frame.size;
+	memcpy(universe, dmx, size);
+	channels = size;
+	header.numFrames++;
+	header.duration = time;
+	numFrames++;
+}
+
+uint8_t * DmxRecorder::reserve(size_t size) {
+	// Move the window forward when the frame does not fit in it
+	if (window == nullptr || writeOffset + size > windowOffset + windowSize) {
+		if (writeOffset + WINDOW_SIZE > fileSize) {
+			fileSize = writeOffset + WINDOW_SIZE;
+			if (!file.resize(fileSize)) {
+				ofLogError("DmxRecorder") << "Could not grow the show file";
+				return nullptr;
+			}
+		}
+		window = file.map(writeOffset, WINDOW_SIZE);
+		windowOffset = writeOffset;
+		windowSize = WINDOW_SIZE;
+		if (window == nullptr) {
+			ofLogError("DmxRecorder") << "Could not map the show file";
+			return nullptr;
+		}
+	}
+	return window + (writeOffset - windowOffset);
+}
+
+void DmxRecorder::finish() {
+	if (!file.isOpen())
+		return;
+
+	// Index and header go at the end and the start of the trimmed file
+	file.unmap();
+	window = nullptr;
+	header.dataEnd = writeOffset;
+	header.indexOffset = writeOffset;
+	header.numKeyframes = index.size();
+	fileSize = writeOffset + index.size() * sizeof(DmxShowIndexEntry);
+	file.resize(fileSize);
+	if (!index.empty()) {
+		uint8_t * dst = file.map(header.indexOffset, index.size() * sizeof(DmxShowIndexEntry));
+		if (dst != nullptr)
+			memcpy(dst, index.data(), index.size() * sizeof(DmxShowIndexEntry));
+	}
+	uint8_t * dst = file.map(0, sizeof(header));
+	if (dst != nullptr)
+		memcpy(dst, &header, sizeof(header));
+	file.close();
+	ofLogVerbose("DmxRecorder") << header.numFrames << " frames, " << header.numKeyframes << " keyframes, " << fileSize << " bytes";
+}
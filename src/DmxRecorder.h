@@ -0,0 +1,70 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxDmxUsbPro.h"
+#include "DmxShowFile.h"
+#include <atomic>
+
+#define DMX_RECORDER_QUEUE_SIZE		256
+
+// Records received universes to a show file.
+// record() only copies the frame into a fixed queue, a background thread
+// delta-encodes it and appends it to the file through a memory-mapped window,
+// so memory use stays bounded however long the recording runs. Frames that
+// arrive while the queue is full are dropped and counted.
+class DmxRecorder : protected ofThread {
+public:
+	DmxRecorder();
+	~DmxRecorder();
+
+	bool start(string path, uint64_t keyframeIntervalMicros = 1000000);
+	void stop();
+	bool isRecording();
+
+	// Records every frame received by the widget while recording, from
+	// before or after start(), until stop()
+	void listen(ofxDmxUsbPro & dmx);
+
+	// Single producer, usually the thread that calls ofxDmxUsbPro::update()
+	void record(const uint8_t * dmx, size_t size);
+
+	uint64_t getNumFrames();
+	uint64_t getNumDropped();
+	uint64_t getFileSize();
+
+protected:
+	void threadedFunction();
+	void dmxReceived(ofxDmxUsbPro::DmxData & data);
+	void writeFrame(uint64_t time, const uint8_t * dmx, size_t size);
+	uint8_t * reserve(size_t size);
+	void finish();
+	void stopWriter();
+
+	typedef struct {
+		uint64_t	time;
+		uint16_t	size;
+		uint8_t		data[512];
+	} Frame;
+
+	Frame queue[DMX_RECORDER_QUEUE_SIZE];
+	std::atomic<size_t> queueHead;
+	std::atomic<size_t> queueTail;
+
+	ofxDmxUsbPro * source;
+	uint64_t startMicros;
+	std::atomic<uint64_t> numFrames;
+	std::atomic<uint64_t> numDropped;
+
+	// Only used by the writer thread
+	DmxMappedFile file;
+	DmxShowHeader header;
+	vector<DmxShowIndexEntry> index;
+	std::atomic<uint64_t> fileSize;
+	uint64_t writeOffset;
+	uint8_t * window;
+	uint64_t windowOffset;
+	size_t windowSize;
+	uint8_t universe[512];
+	uint16_t channels;
+	uint64_t lastKeyframe;
+};
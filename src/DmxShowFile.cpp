@@ -0,0 +1,217 @@
+#include "DmxShowFile.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A run header costs as much as this many unchanged channels
+#define RUN_GAP sizeof(DmxShowRun)
+
+bool DmxShowEncodeDelta(const uint8_t * previous, const uint8_t * current, size_t channels, uint8_t * output, size_t maxSize, size_t & size) {
+	size = 0;
+	size_t i = 0;
+	while (i < channels) {
+		if (previous[i] == current[i]) {
+			i++;
+			continue;
+		}
+
+		// Extend the run over short gaps, a new run would cost more
+		size_t start = i;
+		size_t end = i + 1;
+		size_t j = end;
+		while (j < channels && j - end <= RUN_GAP) {
+			if (previous[j] != current[j])
+				end = j + 1;
+			j++;
+		}
+
+		size_t count = end - start;
+		if (size + sizeof(DmxShowRun) + count > maxSize)
+			return false;
+		DmxShowRun run;
+		run.start = start;
+		run.count = count;
+		memcpy(output + size, &run, sizeof(run));
+		memcpy(output + size + sizeof(run), current + start, count);
+		size += sizeof(run) + count;
+		i = end;
+	}
+	return true;
+}
+
+bool DmxShowApplyDelta(const uint8_t * data, size_t size, uint8_t * universe) {
+	size_t offset = 0;
+	while (offset + sizeof(DmxShowRun) <= size) {
+		DmxShowRun run;
+		memcpy(&run, data + offset, sizeof(run));
+		offset += sizeof(run);
+		if (run.start + run.count > 512 || offset + run.count > size)
+			return false;
+		memcpy(universe + run.start, data + offset, run.count);
+		offset += run.count;
+	}
+	return offset == size;
+}
+
+DmxMappedFile::DmxMappedFile() {
+	writable = false;
+	mapping = nullptr;
+	mappingSize = 0;
+	mappedOffset = 0;
+	mappedSize = 0;
+	mappingShift = 0;
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	fileMapping = nullptr;
+#else
+	file = -1;
+#endif
+}
+
+DmxMappedFile::~DmxMappedFile() {
+	close();
+}
+
+bool DmxMappedFile::open(const std::string & path, bool write) {
+	close();
+	writable = write;
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr, write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	return file != INVALID_HANDLE_VALUE;
+#else
+	file = write ? ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(path.c_str(), O_RDONLY);
+	return file >= 0;
+#endif
+}
+
+void DmxMappedFile::close() {
+	unmap();
+#ifdef _WIN32
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (file >= 0)
+		::close(file);
+	file = -1;
+#endif
+}
+
+bool DmxMappedFile::isOpen() {
+#ifdef _WIN32
+	return file != INVALID_HANDLE_VALUE;
+#else
+	return file >= 0;
+#endif
+}
+
+uint64_t DmxMappedFile::getSize() {
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+		return 0;
+	return size.QuadPart;
+#else
+	struct stat st;
+	if (fstat(file, &st) != 0)
+		return 0;
+	return st.st_size;
+#endif
+}
+
+bool DmxMappedFile::resize(uint64_t size) {
+	// The file can not change size while it is mapped on every platform
+	uint64_t offset = mappedOffset;
+	size_t length = mappedSize;
+	bool wasMapped = mapping != nullptr;
+	unmap();
+#ifdef _WIN32
+	LARGE_INTEGER position;
+	position.QuadPart = size;
+	bool ok = SetFilePointerEx(file, position, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+#else
+	bool ok = ftruncate(file, size) == 0;
+#endif
+	if (wasMapped && offset + length <= size)
+		map(offset, length);
+	return ok;
+}
+
+uint8_t * DmxMappedFile::map(uint64_t offset, size_t size) {
+	unmap();
+	if (!isOpen() || size == 0)
+		return nullptr;
+
+	// Mappings have to start on a multiple of the allocation granularity
+	uint64_t granularity = getGranularity();
+	uint64_t start = offset - offset % granularity;
+	size_t shift = offset - start;
+	size_t length = size + shift;
+
+#ifdef _WIN32
+	uint64_t end = offset + size;
+	fileMapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(end >> 32), (DWORD)end, nullptr);
+	if (fileMapping == nullptr)
+		return nullptr;
+	void * p = MapViewOfFile(fileMapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, length);
+	if (p == nullptr) {
+		CloseHandle(fileMapping);
+		fileMapping = nullptr;
+		return nullptr;
+	}
+#else
+	void * p = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, start);
+	if (p == MAP_FAILED)
+		return nullptr;
+	if (!writable)
+		madvise(p, length, MADV_SEQUENTIAL);
+#endif
+	mapping = (uint8_t*)p;
+	mappingSize = length;
+	mappingShift = shift;
+	mappedOffset = offset;
+	mappedSize = size;
+	return mapping + shift;
+}
+
+void DmxMappedFile::unmap() {
+	if (mapping == nullptr)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(mapping);
+	CloseHandle(fileMapping);
+	fileMapping = nullptr;
+#else
+	munmap(mapping, mappingSize);
+#endif
+	mapping = nullptr;
+	mappingSize = 0;
+	mappedOffset = 0;
+	mappedSize = 0;
+	mappingShift = 0;
+}
+
+uint64_t DmxMappedFile::getMappedOffset() {
+	return mappedOffset;
+}
+
+size_t DmxMappedFile::getMappedSize() {
+	return mappedSize;
+}
+
+uint64_t DmxMappedFile::getGranularity() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+#else
+	return sysconf(_SC_PAGESIZE);
+#endif
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string>
+
+// Show files hold a sequence of timestamped universes. Each frame is either a
+// keyframe with the whole universe or a delta with runs of changed channels.
+// Keyframes are written at a fixed time interval and listed in an index at
+// the end of the file, so a player can seek by jumping to the last keyframe
+// before the wanted time.
+//
+// Layout: header, frames, index. Multi-byte values are little endian.
+
+#define DMX_SHOW_MAGIC				"DMXSHOW"
+#define DMX_SHOW_VERSION			1
+
+#define DMX_SHOW_KEYFRAME			0
+#define DMX_SHOW_DELTA				1
+
+#pragma pack(1)
+typedef struct {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	reserved;
+	uint64_t	keyframeInterval;	// Microseconds
+	uint64_t	numFrames;
+	uint64_t	duration;			// Time of the last frame in microseconds
+	uint64_t	dataEnd;			// Offset of the first byte after the frames
+	uint64_t	indexOffset;		// 0 until the recording is finished
+	uint64_t	numKeyframes;
+} DmxShowHeader;
+
+typedef struct {
+	uint64_t	time;			// Microseconds since the start of the show
+	uint16_t	size;			// Bytes of frame data following the header
+	uint16_t	channels;		// Size of the universe after this frame
+	uint8_t		type;
+} DmxShowFrameHeader;
+
+// Delta frames are a list of runs, each followed by its channel values
+typedef struct {
+	uint16_t	start;
+	uint16_t	count;
+} DmxShowRun;
+
+typedef struct {
+	uint64_t	time;
+	uint64_t	offset;
+} DmxShowIndexEntry;
+#pragma pack()
+
+#define DMX_SHOW_MAX_FRAME_SIZE		(sizeof(DmxShowFrameHeader) + 512)
+
+// Encodes the difference between two universes as runs of changed channels.
+// Size is 0 when nothing changed. Returns false when the delta would be larger
+// than maxSize, in which case a keyframe is the better choice.
+bool DmxShowEncodeDelta(const uint8_t * previous, const uint8_t * current, size_t channels, uint8_t * output, size_t maxSize, size_t & size);
+
+// Applies the runs of a delta frame to a universe
+bool DmxShowApplyDelta(const uint8_t * data, size_t size, uint8_t * universe);
+
+// Memory-mapped view of part of a file. Only one region is mapped at a time.
+class DmxMappedFile {
+public:
+	DmxMappedFile();
+	~DmxMappedFile();
+
+	bool open(const std::string & path, bool write);
+	void close();
+	bool isOpen();
+
+	uint64_t getSize();
+	bool resize(uint64_t size);
+
+	// Returns a pointer to offset, valid until the next map() or unmap()
+	uint8_t * map(uint64_t offset, size_t size);
+	void unmap();
+	uint64_t getMappedOffset();
+	size_t getMappedSize();
+
+protected:
+	uint64_t getGranularity();
+
+	bool writable;
+	uint8_t * mapping;
+	size_t mappingSize;
+	uint64_t mappedOffset;
+	size_t mappedSize;
+	size_t mappingShift;
+#ifdef _WIN32
+	void * file;
+	void * fileMapping;
+#else
+	int file;
+#endif
+};
@@ -0,0 +1,167 @@
+#include "DmxTransform.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#define DMX_TRANSFORM_TABLE_SIZE	257
+
+static double DmxCurveValue(DmxCurve type, const std::vector<uint16_t> & points, double x) {
+	switch (type) {
+		case DMX_CURVE_SQUARE:
+			return x * x;
+		case DMX_CURVE_S:
+			return x * x * (3 - 2 * x);
+		case DMX_CURVE_CUSTOM: {
+			double position = x * (points.size() - 1);
+			size_t i = (size_t)position;
+			if (i + 1 >= points.size())
+				return points.back() / 65535.;
+			double f = position - i;
+			return (points[i] + (points[i + 1] - points[i]) * f) / 65535.;
+		}
+		default:
+			return x;
+	}
+}
+
+DmxTransform::DmxTransform() {
+	clear();
+}
+
+void DmxTransform::setCurve(uint16_t channel, size_t count, DmxCurve curve) {
+	if (curve == DMX_CURVE_CUSTOM)
+		return;
+	setChannels(channel, count, addCurve(curve, std::vector<uint16_t>()));
+}
+
+void DmxTransform::setCurve(uint16_t channel, size_t count, const std::vector<uint16_t> & points) {
+	if (points.size() < 2)
+		return;
+	setChannels(channel, count, addCurve(DMX_CURVE_CUSTOM, points));
+}
+
+DmxCurve DmxTransform::getCurve(uint16_t channel) const {
+	if (channel >= 512)
+		return DMX_CURVE_LINEAR;
+	return curves[curveIndex[channel]].type;
+}
+
+void DmxTransform::set16Bit(uint16_t channel, size_t count, bool enabled) {
+	for (size_t i=0; i<count && channel + 2 * i + 1 < 512; i++) {
+		size_t c = channel + 2 * i;
+		// A channel belongs to one pair at most
+		if (enabled && c > 0)
+			pair[c - 1] = false;
+		pair[c] = enabled;
+		pair[c + 1] = false;
+	}
+	update();
+}
+
+bool DmxTransform::is16Bit(uint16_t channel) const {
+	return channel < 512 && pair[channel];
+}
+
+void DmxTransform::clear() {
+	curves.clear();
+	tables.clear();
+	tables8.clear();
+	addCurve(DMX_CURVE_LINEAR, std::vector<uint16_t>());
+	memset(curveIndex, 0, sizeof(curveIndex));
+	memset(pair, 0, sizeof(pair));
+	update();
+}
+
+bool DmxTransform::isIdentity() const {
+	return identity;
+}
+
+void DmxTransform::apply(const uint8_t * input, uint8_t * output, size_t size) const {
+	if (size > 512)
+		size = 512;
+	if (identity) {
+		memcpy(output, input, size);
+		return;
+	}
+
+	const uint8_t * lut = tables8.data();
+	for (size_t i=0; i<size; i++)
+		output[i] = lut[tableOffset[i] + input[i]];
+
+	for (uint16_t c : pairs) {
+		if (c + 1u >= size)
+			break;
+		// The table entries are 1/255 apart, so a 16-bit value falls between
+		// entries v * 255 / 65535 and the one after
+		const uint16_t * table = tables.data() + curveIndex[c] * DMX_TRANSFORM_TABLE_SIZE;
+		uint32_t position = (input[c] << 8 | input[c + 1]) * 255;
+		uint32_t index = position / 65535;
+		uint32_t fraction = position % 65535;
+		uint32_t value = table[index] + ((int64_t)table[index + 1] - table[index]) * fraction / 65535;
+		output[c] = value >> 8;
+		output[c + 1] = value & 0xFF;
+	}
+}
+
+uint16_t DmxTransform::addCurve(DmxCurve type, const std::vector<uint16_t> & points) {
+	for (size_t i=0; i<curves.size(); i++) {
+		if (curves[i].type == type && curves[i].points == points)
+			return i;
+	}
+
+	// Sampled once here, apply() only reads the tables
+	Curve curve = { type, points };
+	curves.push_back(curve);
+	for (size_t i=0; i<DMX_TRANSFORM_TABLE_SIZE; i++) {
+		double x = std::min<size_t>(i, 255) / 255.;
+		double y = DmxCurveValue(type, points, x);
+		tables.push_back((uint16_t)lround(std::max(0., std::min(y, 1.)) * 65535));
+	}
+	for (size_t i=0; i<256; i++)
+		tables8.push_back((tables[tables.size() - DMX_TRANSFORM_TABLE_SIZE + i] + 128) / 257);
+	return curves.size() - 1;
+}
+
+void DmxTransform::setChannels(uint16_t channel, size_t count, uint16_t curve) {
+	for (size_t i=channel; i<(size_t)channel + count && i < 512; i++)
+		curveIndex[i] = curve;
+	update();
+}
+
+void DmxTransform::update() {
+	// Drop curves no channel uses any more, the linear one stays first
+	std::vector<uint16_t> remap(curves.size(), 0);
+	std::vector<bool> used(curves.size(), false);
+	used[0] = true;
+	for (size_t i=0; i<512; i++)
+		used[curveIndex[i]] = true;
+	size_t n = 0;
+	for (size_t i=0; i<curves.size(); i++) {
+		if (!used[i])
+			continue;
+		if (n != i) {
+			curves[n] = curves[i];
+			std::copy(tables.begin() + i * DMX_TRANSFORM_TABLE_SIZE, tables.begin() + (i + 1) * DMX_TRANSFORM_TABLE_SIZE, tables.begin() + n * DMX_TRANSFORM_TABLE_SIZE);
+			std::copy(tables8.begin() + i * 256, tables8.begin() + (i + 1) * 256, tables8.begin() + n * 256);
+		}
+		remap[i] = n++;
+	}
+	curves.resize(n);
+	tables.resize(n * DMX_TRANSFORM_TABLE_SIZE);
+	tables8.resize(n * 256);
+
+	identity = true;
+	pairs.clear();
+	for (size_t i=0; i<512; i++) {
+		curveIndex[i] = remap[curveIndex[i]];
+		tableOffset[i] = curveIndex[i] * 256;
+		if (curveIndex[i] != 0)
+			identity = false;
+		// The fine channel of a pair follows the curve of the coarse one
+		if (pair[i]) {
+			pairs.push_back(i);
+			if (curveIndex[i] != 0)
+				identity = false;
+		}
+	}
+}
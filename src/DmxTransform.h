@@ -0,0 +1,60 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+typedef enum {
+	DMX_CURVE_LINEAR,
+	DMX_CURVE_SQUARE,	// x^2, finer steps at the low end
+	DMX_CURVE_S,		// 3x^2 - 2x^3, soft at both ends
+	DMX_CURVE_CUSTOM	// Piecewise linear through evenly spaced points
+} DmxCurve;
+
+// Output stage turning the values an app sets into what fixtures expect.
+// Every channel has a response curve, and channels can be paired into 16-bit
+// values with the coarse byte first. Curves are sampled into 16-bit tables
+// when they are set, 8-bit channels use the upper byte and 16-bit channels
+// interpolate between entries.
+//
+// apply() first looks up every channel in its 8-bit table, which is a plain
+// gather over the universe, then redoes the 16-bit pairs from their list.
+class DmxTransform {
+public:
+	DmxTransform();
+
+	void setCurve(uint16_t channel, size_t count, DmxCurve curve);
+	// At least two points, the first for 0 and the last for full
+	void setCurve(uint16_t channel, size_t count, const std::vector<uint16_t> & points);
+	DmxCurve getCurve(uint16_t channel) const;
+
+	// Pairs channel and channel + 1 for each of count 16-bit values
+	void set16Bit(uint16_t channel, size_t count = 1, bool enabled = true);
+	bool is16Bit(uint16_t channel) const;
+
+	void clear();
+	// True when apply() would copy the input unchanged
+	bool isIdentity() const;
+
+	void apply(const uint8_t * input, uint8_t * output, size_t size) const;
+
+protected:
+	typedef struct {
+		DmxCurve				type;
+		std::vector<uint16_t>	points;
+	} Curve;
+
+	uint16_t addCurve(DmxCurve type, const std::vector<uint16_t> & points);
+	void setChannels(uint16_t channel, size_t count, uint16_t curve);
+	void update();
+
+	std::vector<Curve> curves;
+	// 257 entries per curve so interpolation can look one entry ahead
+	std::vector<uint16_t> tables;
+	std::vector<uint8_t> tables8;
+	uint16_t curveIndex[512];
+	uint32_t tableOffset[512];		// Into tables8, curve * 256
+	bool pair[512];					// Coarse channel of a 16-bit pair
+	std::vector<uint16_t> pairs;
+	bool identity;
+};
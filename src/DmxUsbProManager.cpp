@@ -0,0 +1,255 @@
+#include "DmxUsbProManager.h"
+#include <fstream>
+
+DmxUsbProManager::DmxUsbProManager() {
+	rescanMillis = 1000;
+	lastScanMillis = 0;
+}
+
+DmxUsbProManager::~DmxUsbProManager() {
+	if (scan.valid())
+		scan.wait();
+}
+
+void DmxUsbProManager::setPorts(const vector<string> & ports) {
+	this->ports = ports;
+}
+
+void DmxUsbProManager::setUniverse(size_t universe, uint32_t serialNumber) {
+	while (universes.size() <= universe)
+		addUniverse(0);
+	// A widget drives one universe only
+	for (size_t i=0; i<universes.size(); i++) {
+		if (i != universe && universes[i].serialNumber == serialNumber && !universes[i].connected)
+			universes[i].serialNumber = 0;
+	}
+	universes[universe].serialNumber = serialNumber;
+}
+
+void DmxUsbProManager::setRescanInterval(uint64_t millis) {
+	rescanMillis = millis;
+}
+
+void DmxUsbProManager::setup() {
+	// Ports from the cache answer within milliseconds, the others may take
+	// the whole timeout when there is no widget on them
+	vector<string> known;
+	vector<string> others;
+	for (const string & port : getPorts()) {
+		bool cached = false;
+		for (auto & entry : cache)
+			cached = cached || entry.second == port;
+		if (cached)
+			known.push_back(port);
+		else
+			others.push_back(port);
+	}
+
+	vector<Probe> probes = probePorts(known);
+	finishScan(probes);
+	if (universes.empty() || isMissing()) {
+		probes = probePorts(others);
+		finishScan(probes);
+	}
+	lastScanMillis = ofGetElapsedTimeMillis();
+}
+
+void DmxUsbProManager::update() {
+	for (size_t i=0; i<universes.size(); i++) {
+		Universe & universe = universes[i];
+		if (!universe.connected)
+			continue;
+		if (universe.dmx->isConnected()) {
+			universe.dmx->update();
+			continue;
+		}
+		ofLogWarning("ofxDmxUsbPro") << "Widget " << universe.serialNumber << " on universe " << i << " disconnected";
+		universe.dmx->close();
+		universe.connected = false;
+		ofNotifyEvent(universeDisconnected, i, this);
+	}
+
+	if (scan.valid() && scan.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		vector<Probe> probes = scan.get();
+		finishScan(probes);
+	}
+	if (!scan.valid() && rescanMillis > 0 && ofGetElapsedTimeMillis() - lastScanMillis >= rescanMillis)
+		startScan();
+}
+
+size_t DmxUsbProManager::getNumUniverses() {
+	return universes.size();
+}
+
+ofxDmxUsbPro * DmxUsbProManager::getUniverse(size_t universe) {
+	return universe < universes.size() ? universes[universe].dmx.get() : nullptr;
+}
+
+bool DmxUsbProManager::isConnected(size_t universe) {
+	return universe < universes.size() && universes[universe].connected;
+}
+
+uint32_t DmxUsbProManager::getSerialNumber(size_t universe) {
+	return universe < universes.size() ? universes[universe].serialNumber : 0;
+}
+
+string DmxUsbProManager::getPortName(size_t universe) {
+	return isConnected(universe) ? universes[universe].dmx->getPortName() : "";
+}
+
+bool DmxUsbProManager::saveCache(const string & path) {
+	ofstream file(path, ios::trunc);
+	if (!file)
+		return false;
+	// One line per universe: universe, serial number, port last seen on
+	for (size_t i=0; i<universes.size(); i++) {
+		uint32_t serialNumber = universes[i].serialNumber;
+		if (serialNumber != 0 && cache.count(serialNumber))
+			file << i << " " << serialNumber << " " << cache[serialNumber] << "\n";
+	}
+	return file.good();
+}
+
+bool DmxUsbProManager::loadCache(const string & path) {
+	ifstream file(path);
+	if (!file)
+		return false;
+	size_t universe;
+	uint32_t serialNumber;
+	string port;
+	while (file >> universe >> serialNumber && getline(file >> ws, port)) {
+		if (universe >= 512 || serialNumber == 0)
+			continue;
+		cache[serialNumber] = port;
+		// Assignments made in code win over the cache
+		if (findUniverse(serialNumber) == string::npos && (universe >= universes.size() || universes[universe].serialNumber == 0))
+			setUniverse(universe, serialNumber);
+	}
+	return true;
+}
+
+DmxUsbProManager::Probe DmxUsbProManager::probePort(const string & port) {
+	Probe probe;
+	probe.port = port;
+	probe.opened = false;
+	probe.serialNumber = 0;
+	{
+		// Tells a port that is gone from one without a widget
+		DmxUsbProSerial serial;
+		if (!serial.setup(port, 57600))
+			return probe;
+		serial.close();
+	}
+	probe.opened = true;
+	ofxDmxUsbPro dmx;
+	if (dmx.setup(port))
+		probe.serialNumber = dmx.getSerialNumber();
+	return probe;
+}
+
+vector<DmxUsbProManager::Probe> DmxUsbProManager::probePorts(const vector<string> & ports) {
+	vector<std::future<Probe>> futures;
+	for (const string & port : ports)
+		futures.push_back(std::async(std::launch::async, probePort, port));
+	vector<Probe> probes;
+	for (std::future<Probe> & future : futures)
+		probes.push_back(future.get());
+	return probes;
+}
+
+void DmxUsbProManager::startScan() {
+	lastScanMillis = ofGetElapsedTimeMillis();
+	vector<string> available = getPorts();
+
+	// Ports that went away may come back with a widget on them
+	for (auto i = ignoredPorts.begin(); i != ignoredPorts.end();) {
+		if (find(available.begin(), available.end(), *i) == available.end())
+			i = ignoredPorts.erase(i);
+		else
+			++i;
+	}
+
+	vector<string> candidates;
+	for (const string & port : available) {
+		bool used = ignoredPorts.count(port) > 0;
+		for (Universe & universe : universes)
+			used = used || (universe.connected && universe.dmx->getPortName() == port);
+		if (!used)
+			candidates.push_back(port);
+	}
+	if (!candidates.empty())
+		scan = std::async(std::launch::async, probePorts, candidates);
+}
+
+void DmxUsbProManager::finishScan(vector<Probe> & probes) {
+	// New widgets get free universes in order of their serial numbers
+	sort(probes.begin(), probes.end(), [](const Probe & a, const Probe & b) {
+		return a.serialNumber < b.serialNumber;
+	});
+	for (Probe & probe : probes) {
+		if (probe.serialNumber != 0)
+			connect(probe);
+		else if (probe.opened)
+			ignoredPorts.insert(probe.port);
+	}
+}
+
+void DmxUsbProManager::connect(const Probe & probe) {
+	size_t i = findUniverse(probe.serialNumber);
+	if (i == string::npos)
+		i = addUniverse(probe.serialNumber);
+	Universe & universe = universes[i];
+	if (universe.connected)
+		return;
+
+	universe.dmx->close();
+	if (!universe.dmx->setup(probe.port))
+		return;
+	universe.connected = true;
+	cache[probe.serialNumber] = probe.port;
+	ofLogNotice("ofxDmxUsbPro") << "Widget " << probe.serialNumber << " on " << probe.port << " is universe " << i;
+	ofNotifyEvent(universeConnected, i, this);
+}
+
+vector<string> DmxUsbProManager::getPorts() {
+	if (!ports.empty())
+		return ports;
+	vector<string> available;
+	DmxUsbProSerial serial;
+	for (ofSerialDeviceInfo & device : serial.getDeviceList())
+		available.push_back(device.getDevicePath());
+	return available;
+}
+
+size_t DmxUsbProManager::findUniverse(uint32_t serialNumber) {
+	for (size_t i=0; i<universes.size(); i++) {
+		if (universes[i].serialNumber == serialNumber)
+			return i;
+	}
+	return string::npos;
+}
+
+size_t DmxUsbProManager::addUniverse(uint32_t serialNumber) {
+	if (serialNumber != 0) {
+		for (size_t i=0; i<universes.size(); i++) {
+			if (universes[i].serialNumber == 0) {
+				universes[i].serialNumber = serialNumber;
+				return i;
+			}
+		}
+	}
+	Universe universe;
+	universe.serialNumber = serialNumber;
+	universe.connected = false;
+	universe.dmx.reset(new ofxDmxUsbPro());
+	universes.push_back(std::move(universe));
+	return universes.size() - 1;
+}
+
+bool DmxUsbProManager::isMissing() {
+	for (Universe & universe : universes) {
+		if (universe.serialNumber != 0 && !universe.connected)
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxDmxUsbPro.h"
+#include <future>
+#include <set>
+
+// Finds DMX USB Pro widgets and keeps them on fixed logical universes by
+// serial number. All candidate ports are probed at the same time, so setup
+// takes as long as the slowest port instead of the sum of all of them.
+//
+// The ports widgets were found on are kept in a cache. With a cache loaded,
+// setup() probes those ports first and stops there when every assigned
+// widget answered. Widgets found without an assigned universe get the next
+// free one, and the cache keeps that assignment for the next start.
+//
+// update() notices unplugged widgets and probes new ports in the background.
+// A widget that comes back is set up again on the same ofxDmxUsbPro, so
+// listeners and the output universe survive the reconnect.
+class DmxUsbProManager {
+public:
+	DmxUsbProManager();
+	~DmxUsbProManager();
+
+	// Ports to look at, all serial ports when empty
+	void setPorts(const vector<string> & ports);
+	void setUniverse(size_t universe, uint32_t serialNumber);
+	// How often update() looks for new ports, 0 turns it off
+	void setRescanInterval(uint64_t millis);
+
+	// Blocking
+	void setup();
+	void update();
+
+	size_t getNumUniverses();
+	// Stays the same object while the widget is unplugged
+	ofxDmxUsbPro * getUniverse(size_t universe);
+	bool isConnected(size_t universe);
+	uint32_t getSerialNumber(size_t universe);
+	string getPortName(size_t universe);
+
+	bool saveCache(const string & path);
+	bool loadCache(const string & path);
+
+	ofEvent<size_t> universeConnected;
+	ofEvent<size_t> universeDisconnected;
+
+protected:
+	typedef struct {
+		uint32_t					serialNumber;
+		bool						connected;
+		unique_ptr<ofxDmxUsbPro>	dmx;
+	} Universe;
+
+	typedef struct {
+		string		port;
+		bool		opened;
+		uint32_t	serialNumber;		// 0 when no widget answered
+	} Probe;
+
+	static Probe probePort(const string & port);
+	static vector<Probe> probePorts(const vector<string> & ports);
+	void startScan();
+	void finishScan(vector<Probe> & probes);
+	void connect(const Probe & probe);
+	vector<string> getPorts();
+	size_t findUniverse(uint32_t serialNumber);
+	size_t addUniverse(uint32_t serialNumber);
+	bool isMissing();
+
+	vector<Universe> universes;
+	vector<string> ports;
+	// Ports that opened but have no widget, probed again once they are gone
+	set<string> ignoredPorts;
+	// Port each serial number was last seen on
+	map<uint32_t, string> cache;
+	uint64_t rescanMillis;
+	uint64_t lastScanMillis;
+	std::future<vector<Probe>> scan;
+};
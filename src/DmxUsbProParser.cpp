@@ -0,0 +1,233 @@
+#include "DmxUsbProParser.h"
+#include <string.h>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define RING_MASK (DMX_USB_PRO_RING_SIZE - 1)
+
+static inline int countBits(uint32_t m) {
+#if defined(_MSC_VER)
+	m = m - ((m >> 1) & 0x55555555);
+	m = (m & 0x33333333) + ((m >> 2) & 0x33333333);
+	return (((m + (m >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#else
+	return __builtin_popcount(m);
+#endif
+}
+
+static inline int lowestBit(uint32_t m) {
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward(&i, m);
+	return i;
+#else
+	return __builtin_ctz(m);
+#endif
+}
+
+size_t DmxUsbProDecodeChanges(const uint8_t * data, size_t length, uint8_t * universe, uint64_t * changed) {
+	if (length < 6)
+		return 0;
+
+	// Byte 0 is the first changed channel divided by 8, followed by one bit
+	// per channel for the next 40 channels and the values of the set bits
+	size_t start = data[0] * 8;
+	const uint8_t * bits = data + 1;
+	const uint8_t * values = data + 6;
+	size_t numValues = length - 6;
+	size_t n = 0;
+
+	for (size_t byte=0; byte<5; byte++) {
+		uint8_t m = bits[byte];
+		size_t channel = start + byte * 8;
+		if (m == 0 || channel >= 512)
+			continue;
+
+		size_t count = countBits(m);
+		if (n + count > numValues)
+			break;
+		changed[channel / 64] |= (uint64_t)m << (channel % 64);
+
+#if defined(__BMI2__)
+		// Scatter up to 8 values into their lanes with one deposit
+		if (channel + 8 <= 512) {
+			uint64_t lanes = _pdep_u64(m, 0x0101010101010101ull) * 0xFF;
+			uint64_t packed = 0;
+			memcpy(&packed, values + n, count);
+			uint64_t current;
+			memcpy(&current, universe + channel, 8);
+			current = (current & ~lanes) | _pdep_u64(packed, lanes);
+			memcpy(universe + channel, &current, 8);
+			n += count;
+			continue;
+		}
+#endif
+		// One iteration per set bit rather than per channel
+		while (m) {
+			int bit = lowestBit(m);
+			m &= m - 1;
+			if (channel + bit < 512)
+				universe[channel + bit] = values[n];
+			n++;
+		}
+	}
+	return n;
+}
+
+size_t DmxUsbProApplyFrame(const uint8_t * data, size_t size, uint8_t * universe, uint64_t * changed) {
+	if (size > 512)
+		size = 512;
+
+	// Compare 8 channels at a time and turn the differing bytes into 8 mask bits
+	size_t n = 0;
+	size_t channel = 0;
+	for (; channel + 8 <= size; channel += 8) {
+		uint64_t a, b;
+		memcpy(&a, data + channel, 8);
+		memcpy(&b, universe + channel, 8);
+		uint64_t x = a ^ b;
+		if (x == 0)
+			continue;
+		uint64_t high = (((x & 0x7F7F7F7F7F7F7F7Full) + 0x7F7F7F7F7F7F7F7Full) | x) & 0x8080808080808080ull;
+		uint8_t m = (uint8_t)(((high >> 7) * 0x0102040810204080ull) >> 56);
+		changed[channel / 64] |= (uint64_t)m << (channel % 64);
+		n += countBits(m);
+		memcpy(universe + channel, &a, 8);
+	}
+	for (; channel < size; channel++) {
+		if (data[channel] != universe[channel]) {
+			universe[channel] = data[channel];
+			changed[channel / 64] |= 1ull << (channel % 64);
+			n++;
+		}
+	}
+	return n;
+}
+
+DmxUsbProParser::DmxUsbProParser() {
+	head = 0;
+	tail = 0;
+	pending = 0;
+	resyncing = false;
+	resyncCount = 0;
+}
+
+size_t DmxUsbProParser::getSpace() {
+	return DMX_USB_PRO_RING_SIZE - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+}
+
+uint8_t * DmxUsbProParser::getWritePointer(size_t & contiguous) {
+	size_t h = head.load(std::memory_order_relaxed);
+	size_t offset = h & RING_MASK;
+	contiguous = DMX_USB_PRO_RING_SIZE - offset;
+	size_t space = getSpace();
+	if (contiguous > space)
+		contiguous = space;
+	return ring + offset;
+}
+
+void DmxUsbProParser::commitWrite(size_t size) {
+	head.store(head.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+size_t DmxUsbProParser::write(const uint8_t * bytes, size_t size) {
+	size_t written = 0;
+	while (written < size) {
+		size_t contiguous;
+		uint8_t * dst = getWritePointer(contiguous);
+		if (contiguous == 0)
+			break;
+		size_t n = size - written < contiguous ? size - written : contiguous;
+		memcpy(dst, bytes + written, n);
+		commitWrite(n);
+		written += n;
+	}
+	return written;
+}
+
+bool DmxUsbProParser::next(DmxUsbProPacket & packet) {
+	// Release the packet returned by the previous call
+	size_t t = tail.load(std::memory_order_relaxed) + pending;
+	pending = 0;
+	tail.store(t, std::memory_order_release);
+
+	for (;;) {
+		size_t available = head.load(std::memory_order_acquire) - t;
+		if (available == 0)
+			return false;
+
+		if (ring[t & RING_MASK] != DMX_START_CODE) {
+			if (!skipTo(1))
+				return false;
+			t = tail.load(std::memory_order_relaxed);
+			continue;
+		}
+		if (available < 4)
+			return false;
+
+		uint16_t length = ring[(t + 2) & RING_MASK] | (ring[(t + 3) & RING_MASK] << 8);
+		if (length > DMX_USB_PRO_MAX_PAYLOAD) {
+			// Not a real header, look for the next start code
+			skipTo(1);
+			t = tail.load(std::memory_order_relaxed);
+			continue;
+		}
+		if (available < length + 5u)
+			return false;
+
+		if (ring[(t + 4 + length) & RING_MASK] != DMX_END_CODE) {
+			skipTo(1);
+			t = tail.load(std::memory_order_relaxed);
+			continue;
+		}
+
+		resyncing = false;
+		size_t offset = (t + 4) & RING_MASK;
+		packet.label = ring[(t + 1) & RING_MASK];
+		packet.length = length;
+		if (offset + length <= DMX_USB_PRO_RING_SIZE) {
+			packet.data = ring + offset;
+		}
+		else {
+			// Payload wraps around the end of the ring
+			size_t first = DMX_USB_PRO_RING_SIZE - offset;
+			memcpy(scratch, ring + offset, first);
+			memcpy(scratch + first, ring, length - first);
+			packet.data = scratch;
+		}
+		pending = length + 5;
+		return true;
+	}
+}
+
+bool DmxUsbProParser::skipTo(size_t offset) {
+	if (!resyncing) {
+		resyncing = true;
+		resyncCount++;
+	}
+	size_t t = tail.load(std::memory_order_relaxed) + offset;
+	size_t h = head.load(std::memory_order_acquire);
+	while (t != h && ring[t & RING_MASK] != DMX_START_CODE)
+		t++;
+	tail.store(t, std::memory_order_release);
+	return t != h;
+}
+
+size_t DmxUsbProParser::getAvailable() {
+	return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed) - pending;
+}
+
+void DmxUsbProParser::clear() {
+	pending = 0;
+	resyncing = false;
+	tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+uint64_t DmxUsbProParser::getResyncCount() {
+	return resyncCount;
+}
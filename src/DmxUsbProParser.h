@@ -0,0 +1,73 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <atomic>
+
+#define DMX_START_CODE 0x7E 
+#define DMX_END_CODE 0xE7 
+
+#define LABEL_GET_WIDGET_PARAMS		3
+#define LABEL_SET_WIDGET_PARAMS		4
+#define LABEL_PACKET_RECEIVED		5
+#define LABEL_SEND_DMX				6
+#define LABEL_SEND_RDM				7
+#define LABEL_SET_DMX_CHANGE		8
+#define LABEL_DMX_CHANGED			9
+#define LABEL_GET_SERIAL			10
+#define LABEL_SEND_RDM_DISC			11
+#define LABEL_SET_API_KEY			13
+#define LABEL_HARDWARE_VERSION		14
+
+#define DMX_USB_PRO_MAX_PAYLOAD		600
+#define DMX_USB_PRO_RING_SIZE		4096
+
+typedef struct {
+	uint8_t		label;
+	uint8_t *	data;
+	uint16_t	length;
+} DmxUsbProPacket;
+
+// Applies the data of a LABEL_DMX_CHANGED packet to a 512 channel universe
+// and sets the bits of the changed channels in a 512 bit mask (8 words).
+// Returns the number of channels changed.
+size_t DmxUsbProDecodeChanges(const uint8_t * data, size_t length, uint8_t * universe, uint64_t * changed);
+
+// Copies a full frame into a universe and marks the channels that differ
+size_t DmxUsbProApplyFrame(const uint8_t * data, size_t size, uint8_t * universe, uint64_t * changed);
+
+// Incremental parser for the widget protocol.
+// Bytes are written into a ring buffer as they arrive from the serial port and
+// next() returns one complete packet at a time, however the bytes were split
+// over reads. Garbage between packets is skipped until the next start code.
+// One thread may write while another thread parses.
+class DmxUsbProParser {
+public:
+	DmxUsbProParser();
+
+	// Writer side
+	size_t getSpace();
+	uint8_t * getWritePointer(size_t & contiguous);
+	void commitWrite(size_t size);
+	size_t write(const uint8_t * bytes, size_t size);
+
+	// Reader side
+	// The packet data points into the ring buffer and stays valid until the
+	// next call to next() or clear().
+	bool next(DmxUsbProPacket & packet);
+	size_t getAvailable();
+	void clear();
+
+	uint64_t getResyncCount();
+
+protected:
+	bool skipTo(size_t offset);
+
+	uint8_t ring[DMX_USB_PRO_RING_SIZE];
+	uint8_t scratch[DMX_USB_PRO_MAX_PAYLOAD];
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	size_t pending;
+	bool resyncing;
+	uint64_t resyncCount;
+};
@@ -0,0 +1,177 @@
+#include "DmxUsbProPool.h"
+
+DmxUsbProPool::DmxUsbProPool() {
+	running = false;
+	lastCommitMicros = 0;
+	generation = 0;
+	writesLeft = 0;
+	firstStartMicros = 0;
+	lastStartMicros = 0;
+}
+
+DmxUsbProPool::~DmxUsbProPool() {
+	clear();
+}
+
+size_t DmxUsbProPool::add(ofxDmxUsbPro & dmx) {
+	unique_ptr<Worker> worker(new Worker());
+	worker->pool = this;
+	worker->dmx = &dmx;
+	worker->pending = 0;
+	worker->hasPending = false;
+	worker->generation = 0;
+	worker->commitMicros = 0;
+	for (ofxDmxUsbPro::DmxFrame & frame : worker->frames)
+		frame.size = 0;
+	dmx.dmxPooled = true;
+	if (running)
+		worker->startThread();
+	workers.push_back(std::move(worker));
+	return workers.size() - 1;
+}
+
+void DmxUsbProPool::clear() {
+	stop();
+	for (unique_ptr<Worker> & worker : workers)
+		worker->dmx->dmxPooled = false;
+	workers.clear();
+}
+
+size_t DmxUsbProPool::size() {
+	return workers.size();
+}
+
+ofxDmxUsbPro * DmxUsbProPool::get(size_t universe) {
+	return universe < workers.size() ? workers[universe]->dmx : nullptr;
+}
+
+void DmxUsbProPool::start() {
+	if (running)
+		return;
+	running = true;
+	for (unique_ptr<Worker> & worker : workers)
+		worker->startThread();
+}
+
+void DmxUsbProPool::stop() {
+	if (!running)
+		return;
+	running = false;
+	for (unique_ptr<Worker> & worker : workers) {
+		{
+			std::lock_guard<std::mutex> lock(worker->frameMutex);
+			worker->stopThread();
+		}
+		worker->frameCondition.notify_one();
+	}
+	for (unique_ptr<Worker> & worker : workers)
+		worker->waitForThread(false);
+}
+
+bool DmxUsbProPool::isRunning() {
+	return running;
+}
+
+bool DmxUsbProPool::commit() {
+	if (!running || workers.empty())
+		return false;
+
+	// All universes go out together, so at the pace of the slowest widget
+	uint64_t now = ofGetElapsedTimeMicros();
+	uint64_t interval = 0;
+	for (unique_ptr<Worker> & worker : workers) {
+		ofxDmxUsbPro & dmx = *worker->dmx;
+		uint16_t length;
+		{
+			ofScopedLock lock(dmx.dmxMutex);
+			length = dmx.dmxLength;
+		}
+		interval = MAX(interval, dmx.getDmxFrameMicros(length));
+	}
+	if (generation > 0 && now - lastCommitMicros < interval)
+		return false;
+
+	// Take all frames first, then wake the workers one right after the other
+	vector<Worker *> ready;
+	std::unique_lock<std::mutex> lock(mutex);
+	uint64_t commitGeneration = ++generation;
+	for (unique_ptr<Worker> & worker : workers) {
+		std::lock_guard<std::mutex> frameLock(worker->frameMutex);
+		// A frame the worker has not picked up yet is replaced by this one
+		if (worker->dmx->takeDmxFrame(worker->frames[worker->pending], now)) {
+			worker->hasPending = true;
+			worker->generation = commitGeneration;
+			worker->commitMicros = now;
+			ready.push_back(worker.get());
+		}
+	}
+	writesLeft = ready.size();
+	firstStartMicros = UINT64_MAX;
+	lastStartMicros = 0;
+	lock.unlock();
+	if (ready.empty())
+		return false;
+
+	lastCommitMicros = now;
+	for (Worker * worker : ready)
+		worker->frameCondition.notify_one();
+	return true;
+}
+
+DmxUsbProHistogram DmxUsbProPool::getLatency(size_t universe) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return universe < workers.size() ? workers[universe]->latency : DmxUsbProHistogram();
+}
+
+DmxUsbProHistogram DmxUsbProPool::getSkew() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return skew;
+}
+
+void DmxUsbProPool::resetTiming() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (unique_ptr<Worker> & worker : workers)
+		worker->latency.clear();
+	skew.clear();
+}
+
+void DmxUsbProPool::finishWrite(uint64_t generation, uint64_t startMicros) {
+	// Called with mutex locked. A commit that was overtaken by the next one
+	// has no complete set of writes to compare.
+	if (generation != this->generation || writesLeft == 0)
+		return;
+	firstStartMicros = MIN(firstStartMicros, startMicros);
+	lastStartMicros = MAX(lastStartMicros, startMicros);
+	if (--writesLeft == 0)
+		skew.add(lastStartMicros - firstStartMicros);
+}
+
+void DmxUsbProPool::Worker::threadedFunction() {
+	std::unique_lock<std::mutex> lock(frameMutex);
+	while (isThreadRunning()) {
+		frameCondition.wait(lock, [&] {
+			return hasPending || !isThreadRunning();
+		});
+		if (!hasPending)
+			continue;
+
+		// The pool fills the other frame from now on
+		ofxDmxUsbPro::DmxFrame & frame = frames[pending];
+		pending ^= 1;
+		hasPending = false;
+		uint64_t frameGeneration = generation;
+		uint64_t frameCommitMicros = commitMicros;
+		lock.unlock();
+
+		// Blocks until the frame is written, so the times are those of the write
+		uint64_t start = dmx->writeFrame(frame);
+		uint64_t end = ofGetElapsedTimeMicros();
+
+		{
+			std::lock_guard<std::mutex> timingLock(pool->mutex);
+			latency.add(end - frameCommitMicros);
+			pool->finishWrite(frameGeneration, start);
+		}
+		lock.lock();
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxDmxUsbPro.h"
+#include <condition_variable>
+#include <mutex>
+
+// Sends the universes of several widgets as one coherent frame. commit()
+// takes the universes of all widgets at the same moment, and a worker
+// thread per widget writes them to all ports in parallel, so universe N no
+// longer goes out a whole write after universe 0.
+//
+// While a widget is in the pool its flushDmx() does nothing and update()
+// is only needed for input and RDM. Do not run its output thread as well.
+// Latency runs from commit() until the frame is written. Skew is the spread
+// between the first and the last write of a commit to start.
+class DmxUsbProPool {
+public:
+	DmxUsbProPool();
+	~DmxUsbProPool();
+
+	// The widgets stay owned by the caller, a DmxUsbProManager for instance
+	size_t add(ofxDmxUsbPro & dmx);
+	void clear();
+	size_t size();
+	ofxDmxUsbPro * get(size_t universe);
+
+	void start();
+	void stop();
+	bool isRunning();
+
+	// Returns false when nothing changed, or when the slowest widget is still
+	// putting the previous frame on the line. Changes then go with the next
+	// commit.
+	bool commit();
+
+	DmxUsbProHistogram getLatency(size_t universe);
+	DmxUsbProHistogram getSkew();
+	void resetTiming();
+
+protected:
+	class Worker : public ofThread {
+	public:
+		DmxUsbProPool *			pool;
+		ofxDmxUsbPro *			dmx;
+		// Each worker waits on its own lock so they all wake up at once
+		// instead of queueing for a shared one
+		std::mutex				frameMutex;
+		std::condition_variable	frameCondition;
+		// The pool fills frames[pending] while the worker writes the other one
+		ofxDmxUsbPro::DmxFrame	frames[2];
+		uint8_t					pending;
+		bool					hasPending;
+		uint64_t				generation;
+		uint64_t				commitMicros;
+		DmxUsbProHistogram		latency;
+
+		void threadedFunction();
+	};
+
+	void finishWrite(uint64_t generation, uint64_t startMicros);
+
+	vector<unique_ptr<Worker>> workers;
+	bool running;
+	uint64_t lastCommitMicros;
+
+	// Guards the timing shared by the workers
+	std::mutex mutex;
+	uint64_t generation;
+	size_t writesLeft;
+	uint64_t firstStartMicros;
+	uint64_t lastStartMicros;
+	DmxUsbProHistogram skew;
+};
@@ -0,0 +1,64 @@
+#include "DmxUsbProQueue.h"
+
+DmxUsbProQueue::DmxUsbProQueue() {
+	stub.next = nullptr;
+	stub.count = 0;
+	head = &stub;
+	tail = &stub;
+}
+
+void DmxUsbProQueue::init(DmxUsbProCommand & command, uint8_t label, const uint8_t * data, size_t length) {
+	command.next = nullptr;
+	command.written = false;
+	command.label = label;
+	command.header[0] = DMX_START_CODE;
+	command.header[1] = label;
+	command.header[2] = length & 0xFF;
+	command.header[3] = (length >> 8) & 0xFF;
+	command.end = DMX_END_CODE;
+	command.buffers[0] = { command.header, sizeof(command.header) };
+	command.buffers[1] = { data, length };
+	command.buffers[2] = { &command.end, 1 };
+	command.count = 3;
+}
+
+void DmxUsbProQueue::init(DmxUsbProCommand & command, const uint8_t * bytes, size_t size) {
+	command.next = nullptr;
+	command.written = false;
+	command.label = size > 1 ? bytes[1] : 0;
+	command.buffers[0] = { bytes, size };
+	command.count = 1;
+}
+
+void DmxUsbProQueue::push(DmxUsbProCommand * command) {
+	command->next.store(nullptr, std::memory_order_relaxed);
+	DmxUsbProCommand * previous = head.exchange(command, std::memory_order_acq_rel);
+	// Until this store the consumer cannot reach the command
+	previous->next.store(command, std::memory_order_release);
+}
+
+DmxUsbProCommand * DmxUsbProQueue::pop() {
+	DmxUsbProCommand * t = tail;
+	DmxUsbProCommand * next = t->next.load(std::memory_order_acquire);
+	if (t == &stub) {
+		if (next == nullptr)
+			return nullptr;
+		tail = next;
+		t = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next != nullptr) {
+		tail = next;
+		return t;
+	}
+	if (t != head.load(std::memory_order_acquire))
+		return nullptr;
+	// t is the last one, put the stub behind it so it can be taken out
+	push(&stub);
+	next = t->next.load(std::memory_order_acquire);
+	if (next != nullptr) {
+		tail = next;
+		return t;
+	}
+	return nullptr;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "DmxUsbProParser.h"
+#include "DmxUsbProSerial.h"
+#include <atomic>
+
+// Packets written with one call, as many as DmxUsbProSerial::writeBuffers() takes
+#define DMX_USB_PRO_MAX_BATCH		8
+
+// Packet waiting to be written. The command and the data its buffers point
+// to belong to the thread that submitted it, usually on its stack, and stay
+// untouched until written is set. Only the header and end code are copied.
+typedef struct DmxUsbProCommand {
+	std::atomic<DmxUsbProCommand *> next;
+	std::atomic<bool>	written;
+	DmxUsbProBuffer		buffers[3];
+	size_t				count;
+	uint8_t				label;
+	uint8_t				header[4];
+	uint8_t				end;
+} DmxUsbProCommand;
+
+// Queue of outbound packets that any number of threads push to without
+// locking, while one thread at a time pops. A push is a single atomic
+// exchange, so a producer never waits for another one or for the writer.
+// Packets come out in the order their pushes took effect.
+class DmxUsbProQueue {
+public:
+	DmxUsbProQueue();
+
+	// Producers
+	static void init(DmxUsbProCommand & command, uint8_t label, const uint8_t * data, size_t length);
+	// Bytes that already form a complete packet
+	static void init(DmxUsbProCommand & command, const uint8_t * bytes, size_t size);
+	void push(DmxUsbProCommand * command);
+
+	// Consumer. Returns nullptr when the queue is empty, and also while the
+	// only remaining push has not finished linking its packet yet.
+	DmxUsbProCommand * pop();
+
+protected:
+	std::atomic<DmxUsbProCommand *> head;	// Last pushed
+	DmxUsbProCommand * tail;				// Next to pop, consumer only
+	DmxUsbProCommand stub;
+};
@@ -0,0 +1,127 @@
+#include "DmxUsbProSerial.h"
+
+#ifndef TARGET_WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#endif
+
+#define MAX_BUFFERS					24
+#ifdef TARGET_LINUX
+#include <linux/serial.h>
+#endif
+
+bool DmxUsbProSerial::waitForData(uint64_t timeOutMicros) {
+	if (!isInitialized())
+		return false;
+	if (available() > 0)
+		return true;
+
+#ifdef TARGET_WIN32
+	// No waitable handle for a non-overlapped port, fall back to polling
+	uint64_t start = ofGetElapsedTimeMicros();
+	while (ofGetElapsedTimeMicros() - start < timeOutMicros) {
+		ofSleepMillis(1);
+		if (available() > 0)
+			return true;
+	}
+	return false;
+#else
+	struct pollfd p;
+	p.fd = fd;
+	p.events = POLLIN;
+	p.revents = 0;
+#ifdef TARGET_LINUX
+	struct timespec timeout;
+	timeout.tv_sec = timeOutMicros / 1000000;
+	timeout.tv_nsec = (timeOutMicros % 1000000) * 1000;
+	int r = ppoll(&p, 1, &timeout, nullptr);
+#else
+	// Round up so a short timeout does not turn into a busy loop
+	int r = poll(&p, 1, (int)((timeOutMicros + 999) / 1000));
+#endif
+	return r > 0 && (p.revents & POLLIN);
+#endif
+}
+
+bool DmxUsbProSerial::isConnected() {
+	if (!isInitialized())
+		return false;
+#ifdef TARGET_WIN32
+	return true;
+#else
+	struct pollfd p;
+	p.fd = fd;
+	p.events = 0;
+	p.revents = 0;
+	return poll(&p, 1, 0) == 0 || !(p.revents & (POLLHUP | POLLERR | POLLNVAL));
+#endif
+}
+
+bool DmxUsbProSerial::setLowLatency(bool lowLatency) {
+#ifdef TARGET_LINUX
+	if (!isInitialized())
+		return false;
+	struct serial_struct serial;
+	if (ioctl(fd, TIOCGSERIAL, &serial) < 0)
+		return false;
+	if (lowLatency)
+		serial.flags |= ASYNC_LOW_LATENCY;
+	else
+		serial.flags &= ~ASYNC_LOW_LATENCY;
+	return ioctl(fd, TIOCSSERIAL, &serial) == 0;
+#else
+	return false;
+#endif
+}
+
+bool DmxUsbProSerial::writeBuffers(const DmxUsbProBuffer * buffers, size_t count) {
+	if (!isInitialized() || count > MAX_BUFFERS)
+		return false;
+
+#ifdef TARGET_WIN32
+	for (size_t i=0; i<count; i++) {
+		if (buffers[i].size > 0 && writeBytes((unsigned char*)buffers[i].data, buffers[i].size) != (long)buffers[i].size)
+			return false;
+	}
+	return true;
+#else
+	struct iovec iov[MAX_BUFFERS];
+	for (size_t i=0; i<count; i++) {
+		iov[i].iov_base = (void*)buffers[i].data;
+		iov[i].iov_len = buffers[i].size;
+	}
+
+	// The port may be non-blocking, so finish partial writes once the
+	// driver has room again
+	struct iovec * v = iov;
+	int n = count;
+	while (n > 0) {
+		ssize_t r = writev(fd, v, n);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return false;
+			struct pollfd p;
+			p.fd = fd;
+			p.events = POLLOUT;
+			p.revents = 0;
+			if (poll(&p, 1, 1000) <= 0)
+				return false;
+			continue;
+		}
+		while (n > 0 && (size_t)r >= v->iov_len) {
+			r -= v->iov_len;
+			v++;
+			n--;
+		}
+		if (n > 0) {
+			v->iov_base = (uint8_t*)v->iov_base + r;
+			v->iov_len -= r;
+		}
+	}
+	return true;
+#endif
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ofMain.h"
+
+// Piece of a packet for DmxUsbProSerial::writeBuffers()
+typedef struct {
+	const uint8_t *	data;
+	size_t			size;
+} DmxUsbProBuffer;
+
+// ofSerial with a blocking wait for incoming data. Instead of polling
+// available() with a sleep in between, waitForData() blocks on the port
+// until bytes arrive or the timeout passes.
+class DmxUsbProSerial : public ofSerial {
+public:
+	// Returns true when data is available, false on timeout or error
+	bool waitForData(uint64_t timeOutMicros);
+
+	// Asks the driver to pass on received bytes right away. FTDI adapters
+	// on Linux otherwise hold them for up to 16 ms. Returns false when the
+	// driver does not support it, which is harmless.
+	bool setLowLatency(bool lowLatency = true);
+
+	// False once the device has gone away, for instance when a USB adapter
+	// was unplugged. The port stays open until closed.
+	bool isConnected();
+
+	// Writes the buffers back to back with a single system call where the
+	// platform allows, so a packet can be sent straight from its header,
+	// payload and end code without copying them together first
+	bool writeBuffers(const DmxUsbProBuffer * buffers, size_t count);
+};
@@ -0,0 +1,549 @@
+#include "DmxUsbProSimulator.h"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+DmxUsbProSimulator::DmxUsbProSimulator() {
+	master = -1;
+	slave = -1;
+	running = false;
+	latencyMicros = 0;
+	baudRate = 0;
+	serialNumber = 0x12345678;
+	widgetParameters[0] = 44;	// Firmware LSB
+	widgetParameters[1] = 1;	// Firmware MSB
+	widgetParameters[2] = 9;	// Break time
+	widgetParameters[3] = 1;	// Mark after break time
+	widgetParameters[4] = 40;	// Refresh rate
+	dmxChangeOnly = false;
+	memset(dmxInput, 0, sizeof(dmxInput));
+	memset(dmxOutput, 0, sizeof(dmxOutput));
+	dmxOutputSize = 0;
+	numDmxFrames = 0;
+	numRdmRequests = 0;
+	numDiscoveryRequests = 0;
+}
+
+DmxUsbProSimulator::~DmxUsbProSimulator() {
+	close();
+}
+
+bool DmxUsbProSimulator::open() {
+#ifdef _WIN32
+	return false;
+#else
+	if (isOpen())
+		return true;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0)
+		return false;
+	if (grantpt(master) != 0 || unlockpt(master) != 0) {
+		::close(master);
+		master = -1;
+		return false;
+	}
+	portName = ptsname(master);
+
+	// Keep the slave side open so the pty survives the host closing the port
+	slave = ::open(portName.c_str(), O_RDWR | O_NOCTTY);
+	if (slave >= 0) {
+		struct termios options;
+		tcgetattr(slave, &options);
+		cfmakeraw(&options);
+		tcsetattr(slave, TCSANOW, &options);
+	}
+
+	parser.clear();
+	running = true;
+	thread = std::thread(&DmxUsbProSimulator::threadedFunction, this);
+	return true;
+#endif
+}
+
+void DmxUsbProSimulator::close() {
+#ifndef _WIN32
+	running = false;
+	if (thread.joinable())
+		thread.join();
+	if (slave >= 0)
+		::close(slave);
+	if (master >= 0)
+		::close(master);
+	slave = -1;
+	master = -1;
+#endif
+}
+
+bool DmxUsbProSimulator::isOpen() {
+	return master >= 0;
+}
+
+std::string DmxUsbProSimulator::getPortName() {
+	return portName;
+}
+
+void DmxUsbProSimulator::setLatency(uint64_t micros) {
+	latencyMicros = micros;
+}
+
+void DmxUsbProSimulator::setBaudRate(uint32_t rate) {
+	baudRate = rate;
+}
+
+void DmxUsbProSimulator::setSerialNumber(uint32_t serial) {
+	std::lock_guard<std::mutex> lock(mutex);
+	serialNumber = serial;
+}
+
+RdmUid DmxUsbProSimulator::addResponder(const RdmUid & uid) {
+	Responder responder;
+	responder.uid = uid;
+	responder.muted = false;
+	responder.identify = false;
+	responder.startAddress = 1;
+	responder.footprint = 4;
+	responder.model = 0x0001;
+	responder.manufacturerLabel = "ofxDmxUsbPro";
+	responder.modelDescription = "Simulated responder";
+	responder.softwareVersionLabel = "1.0";
+	responder.ackTimerMicros = 0;
+	responder.overflowPid = 0;
+	responder.overflowOffset = 0;
+	responder.queuedPid = 0;
+	responder.queuedTime = 0;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	responders.push_back(responder);
+	return uid;
+}
+
+void DmxUsbProSimulator::addResponders(size_t count, uint16_t manufacturerId, uint32_t firstDeviceId) {
+	for (size_t i=0; i<count; i++) {
+		uint32_t deviceId = firstDeviceId + i;
+		RdmUid uid;
+		uid.uid[0] = (manufacturerId >> 8) & 0xFF;
+		uid.uid[1] = manufacturerId & 0xFF;
+		uid.uid[2] = (deviceId >> 24) & 0xFF;
+		uid.uid[3] = (deviceId >> 16) & 0xFF;
+		uid.uid[4] = (deviceId >> 8) & 0xFF;
+		uid.uid[5] = deviceId & 0xFF;
+		addResponder(uid);
+	}
+}
+
+void DmxUsbProSimulator::clearResponders() {
+	std::lock_guard<std::mutex> lock(mutex);
+	responders.clear();
+}
+
+size_t DmxUsbProSimulator::getNumResponders() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return responders.size();
+}
+
+bool DmxUsbProSimulator::getResponder(const RdmUid & uid, Responder & responder) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Responder & r : responders) {
+		if (memcmp(r.uid.uid, uid.uid, sizeof(RdmUid)) == 0) {
+			responder = r;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool DmxUsbProSimulator::setResponder(const Responder & responder) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Responder & r : responders) {
+		if (memcmp(r.uid.uid, responder.uid.uid, sizeof(RdmUid)) == 0) {
+			r = responder;
+			return true;
+		}
+	}
+	return false;
+}
+
+void DmxUsbProSimulator::receiveDmx(const uint8_t * dmx, size_t size) {
+	if (size > 512)
+		size = 512;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!dmxChangeOnly) {
+		uint8_t data[2 + 512];
+		data[0] = 0;	// Status
+		data[1] = 0;	// DMX start code
+		memcpy(data + 2, dmx, size);
+		writePacket(LABEL_PACKET_RECEIVED, data, size + 2, false);
+		memcpy(dmxInput, dmx, size);
+		return;
+	}
+
+	// Change of state: one packet per block of 40 channels that changed
+	for (size_t block=0; block<size; block+=40) {
+		uint8_t data[6 + 40];
+		memset(data, 0, 6);
+		data[0] = block / 8;
+		size_t n = 0;
+		for (size_t i=0; i<40 && block + i < size; i++) {
+			if (dmx[block + i] != dmxInput[block + i]) {
+				data[1 + i / 8] |= 1 << (i % 8);
+				data[6 + n++] = dmx[block + i];
+				dmxInput[block + i] = dmx[block + i];
+			}
+		}
+		if (n > 0)
+			writePacket(LABEL_DMX_CHANGED, data, 6 + n, false);
+	}
+}
+
+void DmxUsbProSimulator::getDmxOutput(uint8_t * dmx, size_t size) {
+	std::lock_guard<std::mutex> lock(mutex);
+	memcpy(dmx, dmxOutput, size < 512 ? size : 512);
+}
+
+uint16_t DmxUsbProSimulator::getDmxOutputSize() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return dmxOutputSize;
+}
+
+uint64_t DmxUsbProSimulator::getNumDmxFrames() {
+	return numDmxFrames;
+}
+
+uint64_t DmxUsbProSimulator::getNumRdmRequests() {
+	return numRdmRequests;
+}
+
+uint64_t DmxUsbProSimulator::getNumDiscoveryRequests() {
+	return numDiscoveryRequests;
+}
+
+void DmxUsbProSimulator::threadedFunction() {
+#ifndef _WIN32
+	while (running) {
+		struct pollfd fd;
+		fd.fd = master;
+		fd.events = POLLIN;
+		if (poll(&fd, 1, 10) <= 0)
+			continue;
+
+		size_t contiguous;
+		uint8_t * dst = parser.getWritePointer(contiguous);
+		ssize_t r = read(master, dst, contiguous);
+		if (r <= 0)
+			continue;
+		parser.commitWrite(r);
+		waitWireTime(r);
+
+		DmxUsbProPacket packet;
+		while (parser.next(packet))
+			processPacket(packet);
+	}
+#endif
+}
+
+void DmxUsbProSimulator::processPacket(DmxUsbProPacket & packet) {
+	std::lock_guard<std::mutex> lock(mutex);
+	switch (packet.label) {
+		case LABEL_GET_WIDGET_PARAMS:
+			writePacket(LABEL_GET_WIDGET_PARAMS, widgetParameters, sizeof(widgetParameters));
+			break;
+		case LABEL_SET_WIDGET_PARAMS:
+			if (packet.length >= 5)
+				memcpy(widgetParameters + 2, packet.data + 2, 3);
+			break;
+		case LABEL_GET_SERIAL: {
+			uint8_t data[4];
+			memcpy(data, &serialNumber, sizeof(data));
+			writePacket(LABEL_GET_SERIAL, data, sizeof(data));
+			break;
+		}
+		case LABEL_SEND_DMX:
+			if (packet.length >= 1 && packet.data[0] == 0) {
+				dmxOutputSize = packet.length - 1 < 512 ? packet.length - 1 : 512;
+				memcpy(dmxOutput, packet.data + 1, dmxOutputSize);
+				numDmxFrames++;
+			}
+			break;
+		case LABEL_SET_DMX_CHANGE:
+			if (packet.length >= 1)
+				dmxChangeOnly = packet.data[0] != 0;
+			break;
+		case LABEL_SEND_RDM:
+			numRdmRequests++;
+			processRdm(packet.data, packet.length);
+			break;
+		case LABEL_SEND_RDM_DISC:
+			numDiscoveryRequests++;
+			processDiscovery(packet.data, packet.length);
+			break;
+	}
+}
+
+void DmxUsbProSimulator::processRdm(uint8_t * data, size_t size) {
+	if (size < sizeof(RdmHeader) + 2)
+		return;
+	RdmMessage request(data, size);
+	if (!request.validateChecksum())
+		return;
+
+	RdmUid dest = request.getDestination();
+	bool broadcast = RdmIsBroadcast(dest);
+	for (Responder & responder : responders) {
+		if (broadcast) {
+			// Manufacturer broadcasts only reach that manufacturer
+			if (dest.uid[0] != 0xFF && (dest.uid[0] != responder.uid.uid[0] || dest.uid[1] != responder.uid.uid[1]))
+				continue;
+		}
+		else if (memcmp(dest.uid, responder.uid.uid, sizeof(RdmUid)) != 0) {
+			continue;
+		}
+
+		RdmMessage reply;
+		if (respond(responder, request, reply) && !broadcast) {
+			uint8_t packet[1 + 257];
+			packet[0] = 0;
+			memcpy(packet + 1, reply.getPacket(), reply.getPacketSize());
+			writePacket(LABEL_PACKET_RECEIVED, packet, reply.getPacketSize() + 1);
+		}
+	}
+}
+
+void DmxUsbProSimulator::processDiscovery(uint8_t * data, size_t size) {
+	if (size < sizeof(RdmHeader) + 12 + 2)
+		return;
+	RdmMessage request(data, size);
+	if (!request.validateChecksum() || request.getParameterID() != DISC_UNIQUE_BRANCH)
+		return;
+
+	uint64_t lower = RdmUidToUint64(request.getDataAsUid(0));
+	uint64_t upper = RdmUidToUint64(request.getDataAsUid(6));
+
+	// Every unmuted responder in range answers at the same time. Overlapping
+	// responses are combined the way colliding drivers tend to corrupt them.
+	uint8_t response[1 + 24];
+	size_t numResponses = 0;
+	for (Responder & responder : responders) {
+		uint64_t id = RdmUidToUint64(responder.uid);
+		if (responder.muted || id < lower || id > upper)
+			continue;
+		uint8_t euid[24];
+		RdmEncodeUid(responder.uid, euid);
+		if (numResponses == 0) {
+			memcpy(response + 1, euid, sizeof(euid));
+		}
+		else {
+			for (size_t i=8; i<sizeof(euid); i++)
+				response[1 + i] &= euid[i];
+		}
+		numResponses++;
+	}
+	if (numResponses == 0)
+		return;
+
+	response[0] = 0;
+	writePacket(LABEL_PACKET_RECEIVED, response, sizeof(response));
+}
+
+bool DmxUsbProSimulator::respond(Responder & responder, RdmMessage & request, RdmMessage & reply) {
+	uint8_t cc = request.getCommandClass();
+	uint16_t pid = request.getParameterID();
+	uint8_t * in = request.getDataBytes();
+	uint8_t inLength = request.getDataLength();
+	uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	std::vector<uint8_t> out;
+	uint8_t responseType = RESPONSE_TYPE_ACK;
+	uint16_t nack = 0xFFFF;
+
+	if (cc == DISCOVERY_COMMAND) {
+		if (pid == DISC_MUTE || pid == DISC_UN_MUTE) {
+			responder.muted = pid == DISC_MUTE;
+			out.push_back(0);	// Control field
+			out.push_back(0);
+		}
+		else {
+			return false;
+		}
+	}
+	else if (cc == GET_COMMAND && pid == QUEUED_MESSAGE) {
+		if (responder.queuedPid != 0 && now >= responder.queuedTime) {
+			pid = responder.queuedPid;
+			nack = getParameter(responder, pid, out);
+		}
+		else {
+			// Nothing ready, an empty status message list says so
+			pid = STATUS_MESSAGES;
+		}
+	}
+	else if (cc == GET_COMMAND) {
+		if (pid == DEVICE_MODEL_DESCRIPTION && responder.ackTimerMicros > 0) {
+			responder.queuedPid = pid;
+			responder.queuedTime = now + responder.ackTimerMicros;
+			uint16_t tenths = (responder.ackTimerMicros + 99999) / 100000;
+			out.push_back(tenths >> 8);
+			out.push_back(tenths & 0xFF);
+			responseType = RESPONSE_TYPE_ACK_TIMER;
+		}
+		else {
+			nack = getParameter(responder, pid, out);
+		}
+	}
+	else if (cc == SET_COMMAND) {
+		switch (pid) {
+			case DMX_START_ADDRESS: {
+				uint16_t address = inLength >= 2 ? (in[0] << 8 | in[1]) : 0;
+				if (inLength != 2)
+					nack = NR_FORMAT_ERROR;
+				else if (address < 1 || address > 512)
+					nack = NR_DATA_OUT_OF_RANGE;
+				else
+					responder.startAddress = address;
+				break;
+			}
+			case IDENTIFY_DEVICE:
+				if (inLength != 1)
+					nack = NR_FORMAT_ERROR;
+				else
+					responder.identify = in[0] != 0;
+				break;
+			default:
+				nack = NR_UNKNOWN_PID;
+		}
+	}
+	else {
+		nack = NR_UNSUPPORTED_COMMAND_CLASS;
+	}
+
+	size_t offset = 0;
+	size_t length = out.size();
+	if (nack != 0xFFFF) {
+		out.assign(2, 0);
+		out[0] = nack >> 8;
+		out[1] = nack & 0xFF;
+		length = 2;
+		responseType = RESPONSE_TYPE_NACK_REASON;
+	}
+	else if (out.size() > RDM_MAX_DATA_LENGTH) {
+		// Continue where the previous reply to the same PID left off
+		if (responder.overflowPid == pid)
+			offset = responder.overflowOffset;
+		length = std::min<size_t>(out.size() - offset, RDM_MAX_DATA_LENGTH);
+		if (offset + length < out.size()) {
+			responder.overflowPid = pid;
+			responder.overflowOffset = offset + length;
+			responseType = RESPONSE_TYPE_ACK_OVERFLOW;
+		}
+		else {
+			responder.overflowPid = 0;
+			responder.overflowOffset = 0;
+		}
+	}
+	// A queued reply is delivered once it has been sent completely
+	if (pid == responder.queuedPid && request.getParameterID() == QUEUED_MESSAGE && responseType == RESPONSE_TYPE_ACK)
+		responder.queuedPid = 0;
+
+	reply.setDataLength(length);
+	reply.copyDataFrom(out.data() + offset, length);
+	reply.setDestination(request.getSource());
+	reply.setSource(responder.uid);
+	reply.setTransactionNumber(request.getTransactionNumber());
+	reply.setResponseType(responseType);
+	reply.setCommandClass(cc + 1);
+	reply.setParameterID(pid);
+	reply.updateChecksum();
+	return true;
+}
+
+uint16_t DmxUsbProSimulator::getParameter(Responder & responder, uint16_t pid, std::vector<uint8_t> & out) {
+	switch (pid) {
+		case DEVICE_INFO:
+			out.resize(19);
+			out[0] = 0x01;	// RDM protocol version 1.0
+			out[1] = 0x00;
+			out[2] = responder.model >> 8;
+			out[3] = responder.model & 0xFF;
+			out[4] = 0x01;	// Product category: fixture
+			out[5] = 0x01;
+			memset(&out[6], 0, 4);	// Software version id
+			out[10] = responder.footprint >> 8;
+			out[11] = responder.footprint & 0xFF;
+			out[12] = 1;	// Current personality
+			out[13] = 1;	// Number of personalities
+			out[14] = responder.startAddress >> 8;
+			out[15] = responder.startAddress & 0xFF;
+			out[16] = 0;	// Sub-device count
+			out[17] = 0;
+			out[18] = 0;	// Sensor count
+			break;
+		case SUPPORTED_PARAMETERS: {
+			std::vector<uint16_t> pids = { DEVICE_MODEL_DESCRIPTION, MANUFACTURER_LABEL };
+			pids.insert(pids.end(), responder.manufacturerParameters.begin(), responder.manufacturerParameters.end());
+			for (uint16_t p : pids) {
+				out.push_back(p >> 8);
+				out.push_back(p & 0xFF);
+			}
+			break;
+		}
+		case DEVICE_MODEL_DESCRIPTION:
+			out.assign(responder.modelDescription.begin(), responder.modelDescription.begin() + std::min<size_t>(responder.modelDescription.size(), 32));
+			break;
+		case MANUFACTURER_LABEL:
+			out.assign(responder.manufacturerLabel.begin(), responder.manufacturerLabel.begin() + std::min<size_t>(responder.manufacturerLabel.size(), 32));
+			break;
+		case SOFTWARE_VERSION_LABEL:
+			out.assign(responder.softwareVersionLabel.begin(), responder.softwareVersionLabel.begin() + std::min<size_t>(responder.softwareVersionLabel.size(), 32));
+			break;
+		case DMX_START_ADDRESS:
+			out.push_back(responder.startAddress >> 8);
+			out.push_back(responder.startAddress & 0xFF);
+			break;
+		case IDENTIFY_DEVICE:
+			out.push_back(responder.identify ? 1 : 0);
+			break;
+		default:
+			return NR_UNKNOWN_PID;
+	}
+	return 0xFFFF;
+}
+
+void DmxUsbProSimulator::writePacket(uint8_t label, const uint8_t * data, size_t length, bool reply) {
+#ifndef _WIN32
+	if (reply && latencyMicros > 0)
+		std::this_thread::sleep_for(std::chrono::microseconds(latencyMicros.load()));
+
+	uint8_t packet[5 + DMX_USB_PRO_MAX_PAYLOAD];
+	packet[0] = DMX_START_CODE;
+	packet[1] = label;
+	packet[2] = length & 0xFF;
+	packet[3] = (length >> 8) & 0xFF;
+	memcpy(packet + 4, data, length);
+	packet[length + 4] = DMX_END_CODE;
+
+	std::lock_guard<std::mutex> lock(writeMutex);
+	size_t written = 0;
+	while (written < length + 5 && master >= 0) {
+		ssize_t w = write(master, packet + written, length + 5 - written);
+		if (w <= 0)
+			break;
+		written += w;
+	}
+	waitWireTime(written);
+#endif
+}
+
+void DmxUsbProSimulator::waitWireTime(size_t bytes) {
+	// 8 data bits, start and stop bit
+	uint32_t rate = baudRate;
+	if (rate > 0)
+		std::this_thread::sleep_for(std::chrono::microseconds((uint64_t)bytes * 10 * 1000000 / rate));
+}
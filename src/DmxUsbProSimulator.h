@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Rdm.h"
+#include "DmxUsbProParser.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Virtual DMX USB Pro widget on a pseudo-terminal.
+// open() creates the pty and getPortName() returns the path to pass to
+// ofxDmxUsbPro::setup(portName). The simulator answers the same labels as a
+// real widget and has a population of RDM responders on its DMX line.
+// Only available on POSIX systems.
+class DmxUsbProSimulator {
+public:
+	DmxUsbProSimulator();
+	~DmxUsbProSimulator();
+
+	bool open();
+	void close();
+	bool isOpen();
+	std::string getPortName();
+
+	// Time from a request arriving until the reply is written
+	void setLatency(uint64_t micros);
+	// Throttles both directions to the given rate, 0 means unlimited
+	void setBaudRate(uint32_t baudRate);
+	void setSerialNumber(uint32_t serialNumber);
+
+	typedef struct {
+		RdmUid		uid;
+		bool		muted;
+		bool		identify;
+		uint16_t	startAddress;
+		uint16_t	footprint;
+		uint16_t	model;
+		std::string	manufacturerLabel;
+		std::string	modelDescription;
+		std::string	softwareVersionLabel;
+		// Listed in SUPPORTED_PARAMETERS after the standard ones. Long lists
+		// are sent in several ACK_OVERFLOW replies.
+		std::vector<uint16_t> manufacturerParameters;
+		// When set, GET DEVICE_MODEL_DESCRIPTION is answered with ACK_TIMER
+		// and the reply can be collected with QUEUED_MESSAGE after this time
+		uint64_t	ackTimerMicros;
+
+		// Reply in progress
+		uint16_t	overflowPid;
+		size_t		overflowOffset;
+		uint16_t	queuedPid;
+		uint64_t	queuedTime;
+	} Responder;
+
+	RdmUid addResponder(const RdmUid & uid);
+	void addResponders(size_t count, uint16_t manufacturerId = 0x7FF0, uint32_t firstDeviceId = 1);
+	void clearResponders();
+	size_t getNumResponders();
+	bool getResponder(const RdmUid & uid, Responder & responder);
+	bool setResponder(const Responder & responder);
+
+	// Sends a DMX frame to the host as if it had been received on the input
+	void receiveDmx(const uint8_t * dmx, size_t size);
+
+	void getDmxOutput(uint8_t * dmx, size_t size);
+	uint16_t getDmxOutputSize();
+	uint64_t getNumDmxFrames();
+	uint64_t getNumRdmRequests();
+	uint64_t getNumDiscoveryRequests();
+
+protected:
+	void threadedFunction();
+	void processPacket(DmxUsbProPacket & packet);
+	void processRdm(uint8_t * data, size_t size);
+	void processDiscovery(uint8_t * data, size_t size);
+	bool respond(Responder & responder, RdmMessage & request, RdmMessage & reply);
+	uint16_t getParameter(Responder & responder, uint16_t pid, std::vector<uint8_t> & out);
+	void writePacket(uint8_t label, const uint8_t * data, size_t length, bool reply = true);
+	void waitWireTime(size_t bytes);
+
+	int master;
+	int slave;
+	std::string portName;
+	std::thread thread;
+	std::atomic<bool> running;
+	std::mutex mutex;
+	std::mutex writeMutex;
+	DmxUsbProParser parser;
+
+	std::atomic<uint64_t> latencyMicros;
+	std::atomic<uint32_t> baudRate;
+	uint32_t serialNumber;
+	uint8_t widgetParameters[5];
+	bool dmxChangeOnly;
+	uint8_t dmxInput[512];
+
+	std::vector<Responder> responders;
+	uint8_t dmxOutput[512];
+	uint16_t dmxOutputSize;
+	std::atomic<uint64_t> numDmxFrames;
+	std::atomic<uint64_t> numRdmRequests;
+	std::atomic<uint64_t> numDiscoveryRequests;
+};
@@ -0,0 +1,49 @@
+#include "DmxUsbProStats.h"
+#include <string.h>
+
+DmxUsbProHistogram::DmxUsbProHistogram() {
+	clear();
+}
+
+void DmxUsbProHistogram::add(uint64_t micros) {
+	int bucket = 0;
+	while (bucket < DMX_USB_PRO_HISTOGRAM_BUCKETS - 1 && micros >= (1ull << bucket))
+		bucket++;
+	buckets[bucket]++;
+	count++;
+	total += micros;
+	if (micros > max)
+		max = micros;
+}
+
+void DmxUsbProHistogram::clear() {
+	count = 0;
+	total = 0;
+	max = 0;
+	memset(buckets, 0, sizeof(buckets));
+}
+
+uint64_t DmxUsbProHistogram::getCount() const {
+	return count;
+}
+
+uint64_t DmxUsbProHistogram::getMax() const {
+	return max;
+}
+
+double DmxUsbProHistogram::getMean() const {
+	return count > 0 ? (double)total / count : 0;
+}
+
+uint64_t DmxUsbProHistogram::getPercentile(float percentile) const {
+	if (count == 0)
+		return 0;
+	uint64_t target = (uint64_t)(percentile * count);
+	uint64_t n = 0;
+	for (int i=0; i<DMX_USB_PRO_HISTOGRAM_BUCKETS; i++) {
+		n += buckets[i];
+		if (n > target || n == count)
+			return i < DMX_USB_PRO_HISTOGRAM_BUCKETS - 1 ? (1ull << i) : max;
+	}
+	return max;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <inttypes.h>
+#include <map>
+
+#define DMX_USB_PRO_HISTOGRAM_BUCKETS	24
+
+// Durations in microseconds, counted in power of two buckets
+class DmxUsbProHistogram {
+public:
+	DmxUsbProHistogram();
+
+	void add(uint64_t micros);
+	void clear();
+
+	uint64_t getCount() const;
+	uint64_t getMax() const;
+	double getMean() const;
+	// Upper bound of the bucket holding the given fraction (0-1) of samples
+	uint64_t getPercentile(float percentile) const;
+
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint64_t buckets[DMX_USB_PRO_HISTOGRAM_BUCKETS];
+};
+
+// Snapshot of the counters collected by ofxDmxUsbPro while stats are enabled
+typedef struct {
+	uint64_t	framesSent;
+	uint64_t	framesReceived;
+	float		framesSentPerSecond;
+	float		framesReceivedPerSecond;
+	float		targetFrameRate;	// Rate the output is scheduled at
+	uint64_t	bytesWritten;
+	DmxUsbProHistogram writeDuration;
+	DmxUsbProHistogram frameInterval;	// Between DMX frames sent
+	DmxUsbProHistogram frameJitter;		// Output thread, from the scheduled time
+	std::map<uint16_t, DmxUsbProHistogram> rdmLatency;	// By PID
+	uint64_t	rdmTimeouts;
+	uint64_t	rdmChecksumFailures;
+	uint64_t	parserResyncs;
+	DmxUsbProHistogram waitDuration;	// Time blocked waiting for replies
+} DmxUsbProStats;
@@ -1,18 +1,24 @@
 #include "Rdm.h"
 #include <sstream>
+#include <string.h>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<RdmMessage>::value, "RdmMessage must stay trivially copyable");
 
 RdmMessage::RdmMessage() {
+	size = 0;
 }
 
 RdmMessage::RdmMessage(uint8_t * msg, size_t size) {
-	message.insert(message.end(), msg, msg + size);
+	setPacket(msg, size);
 }
 
 RdmMessage::RdmMessage(std::vector<uint8_t> & msg) {
-	message.insert(message.end(), msg.begin(), msg.end());
+	setPacket(msg.data(), msg.size());
 }
 
 RdmMessage::RdmMessage(RdmUid uid, uint8_t cc, uint16_t pid) {
+	size = 0;
 	setDestination(uid);
 	setPortID(1);
 	setCommandClass(cc);
@@ -56,8 +62,13 @@ void RdmMessage::setParameterID(uint16_t pid) {
 }
 
 void RdmMessage::setDataLength(uint8_t length) {
-	message.resize(sizeof(RdmHeader) + length + 2);
-	RdmHeader * header = (RdmHeader*)message.data();
+	if (length > RDM_MAX_DATA_LENGTH)
+		length = RDM_MAX_DATA_LENGTH;
+	uint16_t newSize = sizeof(RdmHeader) + length + 2;
+	if (newSize > size)
+		memset(message + size, 0, newSize - size);
+	size = newSize;
+	RdmHeader * header = (RdmHeader*)message;
 	header->startCode = SC_RDM;
 	header->subStartCode = SC_SUB_MESSAGE;
 	header->length = sizeof(RdmHeader) + length;
@@ -65,10 +76,10 @@ void RdmMessage::setDataLength(uint8_t length) {
 }
 
 void RdmMessage::setData(void * data) {
-	if (message.size() < sizeof(RdmHeader))
+	if (size < sizeof(RdmHeader))
 		return;
-	RdmHeader * header = (RdmHeader*)message.data();
-	memcpy(message.data() + sizeof(RdmHeader), data, header->pdl);
+	RdmHeader * header = (RdmHeader*)message;
+	memcpy(message + sizeof(RdmHeader), data, header->pdl);
 }
 
 void RdmMessage::setData(void * data, uint8_t length) {
@@ -82,7 +93,14 @@ void RdmMessage::setData(uint8_t d, uint8_t offset) {
 }
 
 void RdmMessage::copyDataFrom(const void * data, uint8_t length, uint8_t offset) {
-	memcpy(message.data() + sizeof(RdmHeader) + offset, data, length);
+	if (sizeof(RdmHeader) + offset + length > RDM_MAX_PACKET_SIZE - 2)
+		return;
+	memcpy(message + sizeof(RdmHeader) + offset, data, length);
+}
+
+RdmUid RdmMessage::getDestination() {
+	RdmHeader * header = getHeader();
+	return header->destUid;
 }
 
 RdmUid RdmMessage::getSource() {
@@ -95,6 +113,16 @@ uint8_t RdmMessage::getTransactionNumber() {
 	return header->tn;
 }
 
+uint8_t RdmMessage::getResponseType() {
+	RdmHeader * header = getHeader();
+	return header->responseType;
+}
+
+uint8_t RdmMessage::getMessageCount() {
+	RdmHeader * header = getHeader();
+	return header->messageCount;
+}
+
 uint8_t RdmMessage::getCommandClass() {
 	RdmHeader * header = getHeader();
 	return header->cc;
@@ -111,11 +139,11 @@ uint8_t RdmMessage::getDataLength() {
 }
 
 void * RdmMessage::getData() {
-	return message.data() + sizeof(RdmHeader);
+	return message + sizeof(RdmHeader);
 }
 
 uint8_t * RdmMessage::getDataBytes() {
-	return message.data() + sizeof(RdmHeader);
+	return message + sizeof(RdmHeader);
 }
 
 string RdmMessage::getDataAsString(uint8_t offset) {
@@ -134,20 +162,18 @@ RdmUid RdmMessage::getDataAsUid(uint8_t offset) {
 }
 
 uint16_t RdmMessage::calcChecksum() {
-	if (message.size() < sizeof(RdmHeader) + 2)
-		message.resize(sizeof(RdmHeader) + 2);
+	getHeader();
 	uint16_t cs = 0;
 	int i=0;
-	for (; i<message.size()-2; i++) {
+	for (; i<size-2; i++) {
 		cs += message[i];
 	}
 	return cs;
 }
 
 uint16_t RdmMessage::getChecksum() {
-	if (message.size() < sizeof(RdmHeader) + 2)
-		message.resize(sizeof(RdmHeader) + 2);
-	int i = message.size()-2;
+	getHeader();
+	int i = size-2;
 	return message[i+1] | (message[i+0] << 8);
 }
 
@@ -156,38 +182,116 @@ bool RdmMessage::validateChecksum() {
 }
 
 void RdmMessage::updateChecksum() {
-	if (message.size() < sizeof(RdmHeader) + 2)
-		message.resize(sizeof(RdmHeader) + 2);
-
 	uint16_t cs = calcChecksum();
-	int i = message.size()-2;
+	int i = size-2;
 	message[i+0] = (cs >> 8) & 0xFF;
 	message[i+1] = cs & 0xFF;
 }
 
 unsigned char * RdmMessage::getPacket() {
-	return message.data();
+	return message;
 }
 
 size_t RdmMessage::getPacketSize() {
-	return message.size();
+	return size;
 }
 
-void RdmMessage::setPacket(uint8_t * packet, size_t size) {
-	message.clear();
-	message.insert(message.end(), packet, packet + size);
+void RdmMessage::setPacket(const uint8_t * packet, size_t packetSize) {
+	size = packetSize < RDM_MAX_PACKET_SIZE ? packetSize : RDM_MAX_PACKET_SIZE;
+	memcpy(message, packet, size);
 }
 
 RdmHeader * RdmMessage::getHeader() {
-	if (message.size() < sizeof(RdmHeader) + 2) {
-		message.resize(sizeof(RdmHeader) + 2);
-		RdmHeader * header = (RdmHeader*)message.data();
+	if (size < sizeof(RdmHeader) + 2) {
+		memset(message + size, 0, sizeof(RdmHeader) + 2 - size);
+		size = sizeof(RdmHeader) + 2;
+		RdmHeader * header = (RdmHeader*)message;
 		header->startCode = SC_RDM;
 		header->subStartCode = SC_SUB_MESSAGE;
 		header->length = sizeof(RdmHeader);
 		header->pdl = 0;
 	}
-	return (RdmHeader*)message.data();
+	return (RdmHeader*)message;
+}
+
+RdmMessageView::RdmMessageView(const uint8_t * packet, size_t size) : packet(packet), size(size) {
+}
+
+bool RdmMessageView::isValid() const {
+	// Large enough for the header, the parameter data and the checksum
+	return size >= sizeof(RdmHeader) + 2 && size >= sizeof(RdmHeader) + getHeader()->pdl + 2;
+}
+
+RdmUid RdmMessageView::getDestination() const {
+	return getHeader()->destUid;
+}
+
+RdmUid RdmMessageView::getSource() const {
+	return getHeader()->srcUid;
+}
+
+uint8_t RdmMessageView::getTransactionNumber() const {
+	return getHeader()->tn;
+}
+
+uint8_t RdmMessageView::getResponseType() const {
+	return getHeader()->responseType;
+}
+
+uint8_t RdmMessageView::getMessageCount() const {
+	return getHeader()->messageCount;
+}
+
+uint8_t RdmMessageView::getCommandClass() const {
+	return getHeader()->cc;
+}
+
+uint16_t RdmMessageView::getParameterID() const {
+	uint16_t pid = getHeader()->pid;
+	return ((pid >> 8) & 0xFF) | ((pid << 8) & 0xFF00);
+}
+
+uint8_t RdmMessageView::getDataLength() const {
+	return getHeader()->pdl;
+}
+
+const uint8_t * RdmMessageView::getDataBytes() const {
+	return packet + sizeof(RdmHeader);
+}
+
+uint16_t RdmMessageView::getDataAsUint16(uint8_t offset) const {
+	const uint8_t * data = getDataBytes() + offset;
+	return data[0] << 8 | data[1];
+}
+
+uint16_t RdmMessageView::calcChecksum() const {
+	uint16_t cs = 0;
+	for (size_t i=0; i+2<size; i++) {
+		cs += packet[i];
+	}
+	return cs;
+}
+
+uint16_t RdmMessageView::getChecksum() const {
+	if (size < 2)
+		return 0;
+	return packet[size-1] | (packet[size-2] << 8);
+}
+
+bool RdmMessageView::validateChecksum() const {
+	return size >= sizeof(RdmHeader) + 2 && getChecksum() == calcChecksum();
+}
+
+const uint8_t * RdmMessageView::getPacket() const {
+	return packet;
+}
+
+size_t RdmMessageView::getPacketSize() const {
+	return size;
+}
+
+const RdmHeader * RdmMessageView::getHeader() const {
+	return (const RdmHeader*)packet;
 }
 
 RdmUid RdmDecodeUid(uint8_t * euid) {
@@ -199,11 +303,12 @@ RdmUid RdmDecodeUid(uint8_t * euid) {
 	return uid;
 }
 
-bool RdmDecodeUid(uint8_t * euid, RdmUid & uid) {
+bool RdmDecodeUid(uint8_t * euid, size_t length, RdmUid & uid) {
+	// Up to 7 preamble bytes, the separator, 12 bytes of UID and 4 of checksum
 	uint8_t j = 0;
-	while (j < 8 && euid[j] == 0xFE)
+	while (j < 8 && j < length && euid[j] == 0xFE)
 		j++;
-	if (euid[j] != 0xAA) {
+	if (j + 17 > length || euid[j] != 0xAA) {
 		return false;
 	}
 	j++;
@@ -222,6 +327,36 @@ bool RdmDecodeUid(uint8_t * euid, RdmUid & uid) {
 	return true;
 }
 
+size_t RdmEncodeUid(const RdmUid & uid, uint8_t * euid) {
+	// Response to DISC_UNIQUE_BRANCH: preamble, separator, every byte of the
+	// UID twice with alternating bits forced high and the checksum the same way
+	size_t j = 0;
+	for (int i=0; i<7; i++)
+		euid[j++] = 0xFE;
+	euid[j++] = 0xAA;
+	uint16_t cs = 0;
+	for (int i=0; i<6; i++) {
+		euid[j++] = uid.uid[i] | 0xAA;
+		euid[j++] = uid.uid[i] | 0x55;
+		cs += euid[j-2];
+		cs += euid[j-1];
+	}
+	euid[j++] = (cs >> 8) | 0xAA;
+	euid[j++] = (cs >> 8) | 0x55;
+	euid[j++] = (cs & 0xFF) | 0xAA;
+	euid[j++] = (cs & 0xFF) | 0x55;
+	return j;
+}
+
+bool RdmIsBroadcast(const RdmUid & uid) {
+	// All devices, or all devices of one manufacturer
+	for (int i=2; i<6; i++) {
+		if (uid.uid[i] != 0xFF)
+			return false;
+	}
+	return true;
+}
+
 std::string RdmUidToString(const RdmUid & uid) {
 	char sz[13];
 	sprintf(sz, "%02X%02X%02X%02X%02X%02X", uid.uid[0], uid.uid[1], uid.uid[2], uid.uid[3], uid.uid[4], uid.uid[5]);
@@ -238,7 +373,7 @@ RdmUid RdmUidFromString(const string & uidStr) {
 }
 
 uint64_t RdmUidToUint64(const RdmUid & uid) {
-	return uid.uid[0] << 40 | uid.uid[1] << 32 | uid.uid[2] << 24 | uid.uid[3] << 16 | uid.uid[4] << 8 | uid.uid[5];
+	return (uint64_t)uid.uid[0] << 40 | (uint64_t)uid.uid[1] << 32 | (uint64_t)uid.uid[2] << 24 | (uint64_t)uid.uid[3] << 16 | (uint64_t)uid.uid[4] << 8 | uid.uid[5];
 }
 
 RdmUid RdmUidFromUint64(uint64_t i) {
@@ -252,6 +387,39 @@ RdmUid RdmUidFromUint64(uint64_t i) {
 	return uid;
 }
 
+const uint8_t * RdmTransaction::getData() {
+	return data.empty() ? reply.getDataBytes() : data.data();
+}
+
+size_t RdmTransaction::getDataLength() {
+	return data.empty() ? reply.getDataLength() : data.size();
+}
+
+bool RdmParseDeviceInfo(const uint8_t * data, size_t length, RdmDeviceInfo & info) {
+	if (length < 19)
+		return false;
+	info.protocolVersion = data[0] << 8 | data[1];
+	info.model = data[2] << 8 | data[3];
+	info.productCategory = data[4] << 8 | data[5];
+	info.softwareVersion = (uint32_t)data[6] << 24 | data[7] << 16 | data[8] << 8 | data[9];
+	info.footprint = data[10] << 8 | data[11];
+	info.personality = data[12];
+	info.numPersonalities = data[13];
+	info.startAddress = data[14] << 8 | data[15];
+	info.numSubDevices = data[16] << 8 | data[17];
+	info.numSensors = data[18];
+	return true;
+}
+
+bool RdmParseSupportedParameters(const uint8_t * data, size_t length, vector<uint16_t> & pids) {
+	if (length % 2 != 0)
+		return false;
+	pids.clear();
+	for (size_t i=0; i+1<length; i+=2)
+		pids.push_back(data[i] << 8 | data[i+1]);
+	return true;
+}
+
 void RdmDiscovery(RdmMessage & msg, const RdmUid & lowerBound, const RdmUid & upperBound) {
 	RdmUid dst = RdmAllDevicesUid();
 	msg.setDestination(dst);
@@ -3,6 +3,7 @@
 #include <inttypes.h>
 #include <iostream>
 #include <vector>
+#include <functional>
 
 using namespace std;
 
@@ -36,6 +37,15 @@ using namespace std;
 #define IDENTIFY_DEVICE				0x1000
 #define RESET_DEVICE				0x1001
 
+#define NR_UNKNOWN_PID				0x0000
+#define NR_FORMAT_ERROR				0x0001
+#define NR_HARDWARE_FAULT			0x0002
+#define NR_UNSUPPORTED_COMMAND_CLASS	0x0005
+#define NR_DATA_OUT_OF_RANGE		0x0006
+
+#define RDM_MAX_PACKET_SIZE			257
+#define RDM_MAX_DATA_LENGTH			231
+
 #define STATUS_NONE					0x00
 #define STATUS_GET_LAST_MESSAGE		0x01
 #define STATUS_ADVISORY				0x02
@@ -72,6 +82,8 @@ typedef struct {
 const RdmUid rdmUidZero = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 const RdmUid rdmUidAllDevices = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
+// Message with its packet stored inline, so it never allocates and can be
+// copied like a plain struct
 class RdmMessage {
 public:
 	RdmMessage();
@@ -92,8 +104,11 @@ public:
 	void setData(uint8_t data, uint8_t offset = 0);
 	void copyDataFrom(const void * data, uint8_t length, uint8_t offset = 0);
 
+	RdmUid		getDestination();
 	RdmUid		getSource();
 	uint8_t		getTransactionNumber();
+	uint8_t		getResponseType();
+	uint8_t		getMessageCount();
 	uint8_t		getCommandClass();
 	uint16_t	getParameterID();
 	uint8_t		getDataLength();
@@ -110,14 +125,101 @@ public:
 
 	uint8_t * getPacket();
 	size_t getPacketSize();
-	void setPacket(uint8_t * packet, size_t size);
+	void setPacket(const uint8_t * packet, size_t size);
 
 protected:
 	RdmHeader * getHeader();
-	std::vector<unsigned char> message;
+	uint8_t message[RDM_MAX_PACKET_SIZE];
+	uint16_t size;
 };
 
-bool RdmDecodeUid(uint8_t * euid, RdmUid & uid);
+// Read-only view of a packet owned by someone else, typically a reply still
+// sitting in the receive buffer
+class RdmMessageView {
+public:
+	RdmMessageView(const uint8_t * packet, size_t size);
+
+	bool		isValid() const;
+	RdmUid		getDestination() const;
+	RdmUid		getSource() const;
+	uint8_t		getTransactionNumber() const;
+	uint8_t		getResponseType() const;
+	uint8_t		getMessageCount() const;
+	uint8_t		getCommandClass() const;
+	uint16_t	getParameterID() const;
+	uint8_t		getDataLength() const;
+	const uint8_t * getDataBytes() const;
+	uint16_t	getDataAsUint16(uint8_t offset = 0) const;
+
+	uint16_t calcChecksum() const;
+	uint16_t getChecksum() const;
+	bool validateChecksum() const;
+
+	const uint8_t * getPacket() const;
+	size_t getPacketSize() const;
+
+protected:
+	const RdmHeader * getHeader() const;
+	const uint8_t * packet;
+	size_t size;
+};
+
+typedef enum {
+	RDM_PENDING,
+	RDM_ACK,
+	RDM_ACK_TIMER,
+	RDM_NACK,
+	RDM_ACK_OVERFLOW,
+	RDM_BROADCAST,
+	RDM_TIMEOUT,
+	RDM_CANCELLED
+} RdmStatus;
+
+// Largest response assembled from ACK_OVERFLOW parts
+#define RDM_MAX_OVERFLOW_SIZE		4096
+// Follow-ups after ACK_TIMER before giving up, and the wait between them
+// when the device has nothing queued yet
+#define RDM_MAX_QUEUED_POLLS		16
+#define RDM_QUEUED_POLL_INTERVAL	50000
+
+// Request queued on a widget, together with its reply once one arrives
+struct RdmTransaction {
+	uint32_t	id;
+	RdmStatus	status;
+	RdmMessage	request;
+	RdmMessage	reply;
+	uint8_t		attempts;
+	uint64_t	latencyMicros;
+	// Parameter data of a response sent in several ACK_OVERFLOW parts.
+	// Empty when the whole response fit in reply.
+	vector<uint8_t> data;
+
+	const uint8_t * getData();
+	size_t getDataLength();
+};
+
+typedef std::function<void(RdmTransaction &)> RdmCallback;
+
+// Parameter data of a DEVICE_INFO reply
+typedef struct {
+	uint16_t	protocolVersion;
+	uint16_t	model;
+	uint16_t	productCategory;
+	uint32_t	softwareVersion;
+	uint16_t	footprint;
+	uint8_t		personality;
+	uint8_t		numPersonalities;
+	uint16_t	startAddress;
+	uint16_t	numSubDevices;
+	uint8_t		numSensors;
+} RdmDeviceInfo;
+
+bool RdmParseDeviceInfo(const uint8_t * data, size_t length, RdmDeviceInfo & info);
+bool RdmParseSupportedParameters(const uint8_t * data, size_t length, vector<uint16_t> & pids);
+
+bool RdmDecodeUid(uint8_t * euid, size_t length, RdmUid & uid);
+size_t RdmEncodeUid(const RdmUid & uid, uint8_t * euid);
+bool RdmIsBroadcast(const RdmUid & uid);
 std::string RdmUidToString(const RdmUid & uid);
 RdmUid RdmUidFromString(const string & uidStr);
 uint64_t RdmUidToUint64(const RdmUid & uid);
@@ -0,0 +1,149 @@
+#include "RdmBatch.h"
+#include <algorithm>
+#include <string.h>
+
+RdmBatch::RdmBatch() {
+	clear();
+}
+
+size_t RdmBatch::add(const RdmUid & uid, uint16_t pid, uint8_t commandClass, const void * requestData, uint8_t length) {
+	if (length > RDM_MAX_DATA_LENGTH)
+		length = RDM_MAX_DATA_LENGTH;
+
+	RdmBatchEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.uid = uid;
+	entry.pid = pid;
+	entry.commandClass = commandClass;
+	entry.status = RDM_PENDING;
+	entry.requestLength = requestData ? length : 0;
+	entry.requestOffset = data.size();
+	if (entry.requestLength > 0)
+		data.insert(data.end(), (const uint8_t*)requestData, (const uint8_t*)requestData + length);
+	entries.push_back(entry);
+	return entries.size() - 1;
+}
+
+void RdmBatch::add(const vector<RdmUid> & uids, const vector<uint16_t> & pids) {
+	reserve(entries.size() + uids.size() * pids.size());
+	for (const RdmUid & uid : uids)
+		for (uint16_t pid : pids)
+			add(uid, pid);
+}
+
+void RdmBatch::reserve(size_t numEntries) {
+	entries.reserve(numEntries);
+	// Most commissioning replies are short labels or DEVICE_INFO
+	data.reserve(numEntries * 24);
+}
+
+void RdmBatch::clear() {
+	entries.clear();
+	data.clear();
+	active.clear();
+	nextEntry = 0;
+	numDone = 0;
+	cancelled = false;
+}
+
+size_t RdmBatch::size() {
+	return entries.size();
+}
+
+const RdmBatchEntry & RdmBatch::getEntry(size_t index) {
+	return entries[index];
+}
+
+RdmStatus RdmBatch::getStatus(size_t index) {
+	return (RdmStatus)entries[index].status;
+}
+
+const uint8_t * RdmBatch::getReplyData(size_t index) {
+	return data.data() + entries[index].replyOffset;
+}
+
+uint16_t RdmBatch::getReplyLength(size_t index) {
+	return entries[index].replyLength;
+}
+
+string RdmBatch::getReplyAsString(size_t index) {
+	return string((const char*)getReplyData(index), getReplyLength(index));
+}
+
+uint16_t RdmBatch::getReplyAsUint16(size_t index, uint8_t offset) {
+	if (offset + 2 > getReplyLength(index))
+		return 0;
+	const uint8_t * reply = getReplyData(index) + offset;
+	return reply[0] << 8 | reply[1];
+}
+
+uint16_t RdmBatch::getNackReason(size_t index) {
+	if (getStatus(index) != RDM_NACK)
+		return 0;
+	return getReplyAsUint16(index);
+}
+
+size_t RdmBatch::getNumDone() {
+	return numDone;
+}
+
+float RdmBatch::getProgress() {
+	return entries.empty() ? 1.f : (float)numDone / entries.size();
+}
+
+bool RdmBatch::isDone() {
+	return numDone == entries.size();
+}
+
+void RdmBatch::cancel() {
+	cancelled = true;
+}
+
+bool RdmBatch::isCancelled() {
+	return cancelled;
+}
+
+void RdmBatch::setCallback(RdmBatchCallback callback) {
+	this->callback = callback;
+}
+
+bool RdmBatch::nextRequest(size_t & index) {
+	if (nextEntry >= entries.size())
+		return false;
+	index = nextEntry++;
+	return true;
+}
+
+void RdmBatch::getRequest(size_t index, RdmMessage & request) {
+	RdmBatchEntry & entry = entries[index];
+	request = RdmMessage(entry.uid, entry.commandClass, entry.pid);
+	if (entry.requestLength > 0)
+		request.setData(data.data() + entry.requestOffset, entry.requestLength);
+}
+
+void RdmBatch::finishRequest(size_t index, RdmTransaction & transaction) {
+	RdmBatchEntry & entry = entries[index];
+	active.erase(remove(active.begin(), active.end(), transaction.id), active.end());
+	entry.status = transaction.status;
+	entry.attempts = transaction.attempts;
+	entry.latencyMicros = transaction.latencyMicros;
+	if (transaction.status == RDM_ACK || transaction.status == RDM_NACK || transaction.status == RDM_ACK_TIMER || transaction.status == RDM_ACK_OVERFLOW) {
+		entry.replyLength = transaction.getDataLength();
+		entry.replyOffset = data.size();
+		data.insert(data.end(), transaction.getData(), transaction.getData() + entry.replyLength);
+	}
+	numDone++;
+	if (callback)
+		callback(*this, index);
+}
+
+void RdmBatch::cancelRemaining() {
+	// Requests still on the engine must have been cancelled there first
+	for (size_t i=0; i<entries.size(); i++) {
+		if (entries[i].status != RDM_PENDING)
+			continue;
+		entries[i].status = RDM_CANCELLED;
+		numDone++;
+	}
+	nextEntry = entries.size();
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Rdm.h"
+#include <atomic>
+#include <string>
+
+// One row of a batch. Request and reply data live in a shared buffer owned
+// by the batch, so a row stays small no matter how long the replies are.
+typedef struct {
+	RdmUid		uid;
+	uint16_t	pid;
+	uint8_t		commandClass;
+	uint8_t		status;			// RdmStatus
+	uint8_t		attempts;
+	uint8_t		requestLength;
+	uint16_t	replyLength;
+	uint32_t	requestOffset;
+	uint32_t	replyOffset;
+	uint32_t	latencyMicros;
+} RdmBatchEntry;
+
+class RdmBatch;
+typedef std::function<void(RdmBatch &, size_t)> RdmBatchCallback;
+
+// List of GET and SET requests to many devices, run with
+// ofxDmxUsbPro::sendRdmBatch() or getRdmBatch(). Requests are pipelined on
+// the transaction engine, which retries timeouts and collects ACK_TIMER and
+// ACK_OVERFLOW replies while the rest of the batch keeps going.
+class RdmBatch {
+public:
+	RdmBatch();
+
+	size_t add(const RdmUid & uid, uint16_t pid, uint8_t commandClass = GET_COMMAND, const void * data = nullptr, uint8_t length = 0);
+	// Gets every PID from every device
+	void add(const vector<RdmUid> & uids, const vector<uint16_t> & pids);
+	void reserve(size_t numEntries);
+	void clear();
+
+	size_t size();
+	const RdmBatchEntry & getEntry(size_t index);
+	RdmStatus getStatus(size_t index);
+	const uint8_t * getReplyData(size_t index);
+	uint16_t getReplyLength(size_t index);
+	string getReplyAsString(size_t index);
+	uint16_t getReplyAsUint16(size_t index, uint8_t offset = 0);
+	uint16_t getNackReason(size_t index);
+
+	size_t getNumDone();
+	float getProgress();
+	bool isDone();
+
+	// Takes effect on the next ofxDmxUsbPro::update(), requests that have
+	// not completed by then end up as RDM_CANCELLED
+	void cancel();
+	bool isCancelled();
+
+	// Called from update() every time a request completes
+	void setCallback(RdmBatchCallback callback);
+
+protected:
+	friend class ofxDmxUsbPro;
+
+	// Next request not sent yet, false when all have been sent
+	bool nextRequest(size_t & index);
+	void getRequest(size_t index, RdmMessage & request);
+	void finishRequest(size_t index, RdmTransaction & transaction);
+	void cancelRemaining();
+
+	vector<RdmBatchEntry> entries;
+	vector<uint8_t> data;
+	size_t nextEntry;
+	vector<uint32_t> active;		// Transaction ids queued on the engine
+	std::atomic<size_t> numDone;
+	std::atomic<bool> cancelled;
+	RdmBatchCallback callback;
+};
@@ -0,0 +1,266 @@
+#include "RdmDeviceCache.h"
+#include <chrono>
+#include <fstream>
+#include <string.h>
+
+#define RDM_CACHE_MAGIC				"RDMCACHE"
+#define RDM_CACHE_VERSION			2
+
+RdmDeviceCache::RdmDeviceCache() {
+	numHits = 0;
+	numMisses = 0;
+
+	// Data that only changes with a firmware update
+	setTtl(SUPPORTED_PARAMETERS, RDM_CACHE_FOREVER);
+	setTtl(PARAMETER_DESCRIPTION, RDM_CACHE_FOREVER);
+	setTtl(DEVICE_MODEL_DESCRIPTION, RDM_CACHE_FOREVER);
+	setTtl(MANUFACTURER_LABEL, RDM_CACHE_FOREVER);
+	setTtl(SOFTWARE_VERSION_LABEL, RDM_CACHE_FOREVER);
+
+	// Can be changed from the device's own panel without a SET on the line
+	setTtl(DEVICE_INFO, 10000000);
+	setTtl(DMX_START_ADDRESS, 10000000);
+}
+
+void RdmDeviceCache::setTtl(uint16_t pid, uint64_t micros) {
+	if (micros == 0)
+		ttls.erase(pid);
+	else
+		ttls[pid] = micros;
+}
+
+uint64_t RdmDeviceCache::getTtl(uint16_t pid) {
+	map<uint16_t, uint64_t>::iterator it = ttls.find(pid);
+	return it != ttls.end() ? it->second : 0;
+}
+
+void RdmDeviceCache::set(const RdmUid & uid, uint16_t pid, const uint8_t * data, size_t length, uint16_t arg) {
+	Entry & entry = devices[RdmUidToUint64(uid)][(uint32_t)pid << 16 | arg];
+	entry.time = getTime();
+	entry.data.assign(data, data + length);
+}
+
+bool RdmDeviceCache::get(const RdmUid & uid, uint16_t pid, vector<uint8_t> & data, uint16_t arg) {
+	const Entry * entry = find(uid, pid, arg);
+	if (!entry)
+		return false;
+	data = entry->data;
+	return true;
+}
+
+bool RdmDeviceCache::getDeviceInfo(const RdmUid & uid, RdmDeviceInfo & info) {
+	const Entry * entry = find(uid, DEVICE_INFO, 0);
+	return entry && RdmParseDeviceInfo(entry->data.data(), entry->data.size(), info);
+}
+
+bool RdmDeviceCache::getSupportedParameters(const RdmUid & uid, vector<uint16_t> & pids) {
+	const Entry * entry = find(uid, SUPPORTED_PARAMETERS, 0);
+	return entry && RdmParseSupportedParameters(entry->data.data(), entry->data.size(), pids);
+}
+
+bool RdmDeviceCache::getString(const RdmUid & uid, uint16_t pid, string & str) {
+	const Entry * entry = find(uid, pid, 0);
+	if (!entry)
+		return false;
+	str.assign((const char*)entry->data.data(), entry->data.size());
+	return true;
+}
+
+bool RdmDeviceCache::getReply(RdmTransaction & transaction, const RdmUid & controller) {
+	RdmMessage & request = transaction.request;
+	if (request.getCommandClass() != GET_COMMAND)
+		return false;
+	RdmUid uid = request.getDestination();
+	if (RdmIsBroadcast(uid))
+		return false;
+	uint16_t pid = request.getParameterID();
+	if (getTtl(pid) == 0)
+		return false;
+
+	const Entry * entry = find(uid, pid, getArgument(pid, request.getDataBytes(), request.getDataLength()));
+	if (!entry) {
+		numMisses++;
+		return false;
+	}
+	numHits++;
+	// Data that needed several overflow replies goes in the transaction
+	const vector<uint8_t> & data = entry->data;
+	size_t length = data.size() > RDM_MAX_DATA_LENGTH ? 0 : data.size();
+	RdmMessage & reply = transaction.reply;
+	// The request is answered before it is sent, so its source is not set yet
+	reply = RdmMessage(controller, GET_COMMAND_RESPONSE, pid);
+	reply.setSource(uid);
+	reply.setTransactionNumber(request.getTransactionNumber());
+	reply.setResponseType(RESPONSE_TYPE_ACK);
+	reply.setData((void*)data.data(), length);
+	reply.updateChecksum();
+	if (length < data.size())
+		transaction.data = data;
+	else
+		transaction.data.clear();
+	return true;
+}
+
+void RdmDeviceCache::store(RdmTransaction & transaction) {
+	RdmMessage & request = transaction.request;
+	uint16_t pid = request.getParameterID();
+	if (transaction.status != RDM_ACK || request.getCommandClass() != GET_COMMAND || getTtl(pid) == 0)
+		return;
+	set(request.getDestination(), pid, transaction.getData(), transaction.getDataLength(), getArgument(pid, request.getDataBytes(), request.getDataLength()));
+}
+
+void RdmDeviceCache::observe(const RdmMessageView & reply) {
+	if (!reply.isValid())
+		return;
+	RdmUid uid = reply.getSource();
+	uint16_t pid = reply.getParameterID();
+	uint8_t cc = reply.getCommandClass();
+
+	// Queued or status messages mean something changed on the device
+	if (reply.getMessageCount() > 0 || (pid == STATUS_MESSAGES && cc == GET_COMMAND_RESPONSE && reply.getDataLength() > 0)) {
+		invalidate(uid);
+	}
+	else if (cc == SET_COMMAND_RESPONSE && reply.getResponseType() == RESPONSE_TYPE_ACK) {
+		invalidate(uid, pid);
+		// Most settings are mirrored in DEVICE_INFO
+		invalidate(uid, DEVICE_INFO);
+	}
+}
+
+void RdmDeviceCache::invalidate(const RdmUid & uid, uint16_t pid) {
+	map<uint64_t, Device>::iterator it = devices.find(RdmUidToUint64(uid));
+	if (it == devices.end())
+		return;
+	Device & device = it->second;
+	device.erase(device.lower_bound((uint32_t)pid << 16), device.upper_bound((uint32_t)pid << 16 | 0xFFFF));
+}
+
+void RdmDeviceCache::invalidate(const RdmUid & uid) {
+	map<uint64_t, Device>::iterator it = devices.find(RdmUidToUint64(uid));
+	if (it != devices.end())
+		it->second.clear();
+}
+
+void RdmDeviceCache::remove(const RdmUid & uid) {
+	devices.erase(RdmUidToUint64(uid));
+}
+
+void RdmDeviceCache::retain(const vector<RdmUid> & uids) {
+	map<uint64_t, Device> found;
+	for (const RdmUid & uid : uids) {
+		map<uint64_t, Device>::iterator it = devices.find(RdmUidToUint64(uid));
+		if (it != devices.end())
+			found[it->first].swap(it->second);
+	}
+	devices.swap(found);
+}
+
+void RdmDeviceCache::clear() {
+	devices.clear();
+	numHits = 0;
+	numMisses = 0;
+}
+
+vector<RdmUid> RdmDeviceCache::getDevices() {
+	vector<RdmUid> uids;
+	uids.reserve(devices.size());
+	for (map<uint64_t, Device>::iterator it = devices.begin(); it != devices.end(); ++it)
+		uids.push_back(RdmUidFromUint64(it->first));
+	return uids;
+}
+
+size_t RdmDeviceCache::getNumDevices() {
+	return devices.size();
+}
+
+bool RdmDeviceCache::hasDevice(const RdmUid & uid) {
+	return devices.count(RdmUidToUint64(uid)) > 0;
+}
+
+uint64_t RdmDeviceCache::getNumHits() {
+	return numHits;
+}
+
+uint64_t RdmDeviceCache::getNumMisses() {
+	return numMisses;
+}
+
+// File layout: magic, version, then one record per entry with the UID, PID,
+// argument, time, data length and data. Multi-byte values are little endian.
+bool RdmDeviceCache::save(const string & path) {
+	ofstream file(path, ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	uint32_t version = RDM_CACHE_VERSION;
+	file.write(RDM_CACHE_MAGIC, 8);
+	file.write((const char*)&version, sizeof(version));
+	for (map<uint64_t, Device>::iterator d = devices.begin(); d != devices.end(); ++d) {
+		RdmUid uid = RdmUidFromUint64(d->first);
+		for (Device::iterator e = d->second.begin(); e != d->second.end(); ++e) {
+			uint32_t key = e->first;
+			uint16_t length = e->second.data.size();
+			file.write((const char*)uid.uid, sizeof(uid.uid));
+			file.write((const char*)&key, sizeof(key));
+			file.write((const char*)&e->second.time, sizeof(e->second.time));
+			file.write((const char*)&length, sizeof(length));
+			file.write((const char*)e->second.data.data(), length);
+		}
+	}
+	return (bool)file;
+}
+
+bool RdmDeviceCache::load(const string & path) {
+	ifstream file(path, ios::binary);
+	char magic[8];
+	uint32_t version = 0;
+	if (!file.read(magic, 8) || memcmp(magic, RDM_CACHE_MAGIC, 8) != 0)
+		return false;
+	if (!file.read((char*)&version, sizeof(version)) || version != RDM_CACHE_VERSION)
+		return false;
+
+	uint64_t now = getTime();
+	RdmUid uid;
+	uint32_t key;
+	Entry entry;
+	uint16_t length;
+	while (file.read((char*)uid.uid, sizeof(uid.uid)) &&
+		file.read((char*)&key, sizeof(key)) &&
+		file.read((char*)&entry.time, sizeof(entry.time)) &&
+		file.read((char*)&length, sizeof(length))) {
+		entry.data.resize(length);
+		if (!file.read((char*)entry.data.data(), length))
+			return false;
+		// Entries that expired while the app was not running are not needed
+		uint64_t ttl = getTtl(key >> 16);
+		if (ttl == RDM_CACHE_FOREVER || (ttl > 0 && now - entry.time < ttl))
+			devices[RdmUidToUint64(uid)][key] = entry;
+	}
+	return true;
+}
+
+uint64_t RdmDeviceCache::getTime() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+uint16_t RdmDeviceCache::getArgument(uint16_t pid, const uint8_t * data, size_t length) {
+	if (pid == PARAMETER_DESCRIPTION && length >= 2)
+		return data[0] << 8 | data[1];
+	return 0;
+}
+
+const RdmDeviceCache::Entry * RdmDeviceCache::find(const RdmUid & uid, uint16_t pid, uint16_t arg) {
+	map<uint64_t, Device>::iterator d = devices.find(RdmUidToUint64(uid));
+	if (d == devices.end())
+		return nullptr;
+	Device::iterator e = d->second.find((uint32_t)pid << 16 | arg);
+	if (e == d->second.end())
+		return nullptr;
+
+	uint64_t ttl = getTtl(pid);
+	if (ttl == 0 || (ttl != RDM_CACHE_FOREVER && getTime() - e->second.time >= ttl)) {
+		d->second.erase(e);
+		return nullptr;
+	}
+	return &e->second;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Rdm.h"
+#include <map>
+#include <string>
+
+#define RDM_CACHE_FOREVER			UINT64_MAX
+
+// Parameter data of GET replies per device and PID, so static data such as
+// SUPPORTED_PARAMETERS or labels is only read from the line once.
+//
+// Every PID has a time to live, PIDs without one are not cached. Entries are
+// dropped when a SET to the device is acknowledged, when a reply reports
+// queued or status messages, and when a full discovery no longer finds the
+// device. Times are wall clock, so a saved cache can be loaded after a
+// restart and still expires correctly.
+//
+// Not thread safe, ofxDmxUsbPro only uses it from update().
+class RdmDeviceCache {
+public:
+	RdmDeviceCache();
+
+	void setTtl(uint16_t pid, uint64_t micros);
+	uint64_t getTtl(uint16_t pid);
+
+	// arg tells apart replies to the same PID that depend on the request
+	// data, such as the PID asked about in PARAMETER_DESCRIPTION
+	void set(const RdmUid & uid, uint16_t pid, const uint8_t * data, size_t length, uint16_t arg = 0);
+	bool get(const RdmUid & uid, uint16_t pid, vector<uint8_t> & data, uint16_t arg = 0);
+	bool getDeviceInfo(const RdmUid & uid, RdmDeviceInfo & info);
+	bool getSupportedParameters(const RdmUid & uid, vector<uint16_t> & pids);
+	bool getString(const RdmUid & uid, uint16_t pid, string & str);
+
+	// Answers a GET request with a reply as if it came from the device,
+	// addressed to the controller that would have sent the request
+	bool getReply(RdmTransaction & transaction, const RdmUid & controller);
+	// Stores the response of a completed GET
+	void store(RdmTransaction & transaction);
+	// Drops entries a reply seen on the line says are out of date
+	void observe(const RdmMessageView & reply);
+
+	void invalidate(const RdmUid & uid, uint16_t pid);
+	void invalidate(const RdmUid & uid);
+	void remove(const RdmUid & uid);
+	// Drops every device not in the list, for use after a full discovery
+	void retain(const vector<RdmUid> & uids);
+	void clear();
+
+	vector<RdmUid> getDevices();
+	size_t getNumDevices();
+	bool hasDevice(const RdmUid & uid);
+	uint64_t getNumHits();
+	uint64_t getNumMisses();
+
+	bool save(const string & path);
+	bool load(const string & path);
+
+protected:
+	typedef struct {
+		uint64_t		time;
+		vector<uint8_t>	data;
+	} Entry;
+
+	// Entries by PID in the high and argument in the low 16 bits
+	typedef map<uint32_t, Entry> Device;
+
+	static uint64_t getTime();
+	static uint16_t getArgument(uint16_t pid, const uint8_t * data, size_t length);
+	const Entry * find(const RdmUid & uid, uint16_t pid, uint16_t arg);
+
+	map<uint64_t, Device> devices;
+	map<uint16_t, uint64_t> ttls;
+	uint64_t numHits;
+	uint64_t numMisses;
+};
@@ -1,19 +1,9 @@
 #include "ofxDmxUsbPro.h"
 
-#define DMX_START_CODE 0x7E 
-#define DMX_END_CODE 0xE7 
-
-#define LABEL_GET_WIDGET_PARAMS		3
-#define LABEL_SET_WIDGET_PARAMS		4
-#define LABEL_PACKET_RECEIVED		5
-#define LABEL_SEND_DMX				6
-#define LABEL_SEND_RDM				7
-#define LABEL_SET_DMX_CHANGE		8
-#define LABEL_DMX_CHANGED			9
-#define LABEL_GET_SERIAL			10
-#define LABEL_SEND_RDM_DISC			11
-#define LABEL_SET_API_KEY			13
-#define LABEL_HARDWARE_VERSION		14
+#define FRAME_INDEX					0x03
+#define FRAME_NEW					0x04
+// Rounds a thread waiting on a writer tries again before it sleeps
+#define WRITE_SPINS					64
 
 
 ofxDmxUsbPro::ofxDmxUsbPro() {
@@ -21,6 +11,55 @@ ofxDmxUsbPro::ofxDmxUsbPro() {
 	serialNumber = 0;
 	hardwareVersion = 0;
 	rdmTransactionNumber = 0;
+	rdmNextId = 1;
+	rdmTimeoutMicros = 100000;
+	rdmRetries = 1;
+	rdmMaxInFlight = 1;
+	rdmDiscoveryTimeoutMicros = 30000;
+	rdmCacheEnabled = false;
+	statsEnabled = false;
+	resetStats();
+	memset(dmxInput, 0, sizeof(dmxInput));
+	dmxInputSize = 0;
+	received.label = 0;
+	received.data = nullptr;
+	received.length = 0;
+	for (DmxFrame & frame : frames)
+		frame.size = 0;
+	frameFront = 0;
+	frameSwap = 1;
+	frameBack = 2;
+	threadFrameRate = 0;
+	threadOutput = false;
+	threadInput = false;
+	inputSequence = 0;
+	inputSeen = 0;
+	memset(bridgeInput, 0, sizeof(bridgeInput));
+	memset(bridgeOutput, 0, sizeof(bridgeOutput));
+	bridgeTarget = nullptr;
+	bridgeDueMicros = 0;
+	bridgeHeldMicros = 0;
+	// Widget defaults until the real parameters are known
+	dmxBreakMicros = 96;
+	dmxMabMicros = 11;
+	dmxRefreshRate = 40;
+	memset(dmxUniverse, 0, sizeof(dmxUniverse));
+	dmxLength = 0;
+	dmxDirtyLow = 512;
+	dmxDirtyHigh = 0;
+	dmxKeepAliveMillis = 1000;
+	dmxBatching = false;
+	dmxLastSendMicros = 0;
+	writing.clear();
+	writeRequests = 0;
+	writeWaiters = 0;
+	dmxFading = false;
+	dmxPooled = false;
+}
+
+ofxDmxUsbPro::~ofxDmxUsbPro() {
+	stopBridge();
+	stopThread();
 }
 
 void ofxDmxUsbPro::listDevices() {
@@ -36,24 +75,48 @@ int ofxDmxUsbPro::getNumDevices() {
 }
 
 bool ofxDmxUsbPro::setup(int deviceNumber) {
-	if (serial.setup(deviceNumber, 57600))
-		return init();
-	else
-		return false;
+	vector<ofSerialDeviceInfo> devices = serial.getDeviceList();
+	if (deviceNumber >= 0 && deviceNumber < (int)devices.size())
+		portName = devices[deviceNumber].getDevicePath();
+	lockWriter();
+	bool r = serial.setup(deviceNumber, 57600);
+	unlockWriter();
+	return r && init();
 }
 
 bool ofxDmxUsbPro::setup(string portName) {
-	if (serial.setup(portName, 57600))
-		return init();
-	else
-		return false;
+	this->portName = portName;
+	// The output thread may still be running from before a reconnect
+	lockWriter();
+	bool r = serial.setup(portName, 57600);
+	unlockWriter();
+	return r && init();
+}
+
+void ofxDmxUsbPro::close() {
+	stopBridge();
+	// Not in the middle of a write from another thread
+	lockWriter();
+	serial.close();
+	unlockWriter();
+}
+
+bool ofxDmxUsbPro::isConnected() {
+	return serial.isConnected();
+}
+
+string ofxDmxUsbPro::getPortName() {
+	return portName;
 }
 
 bool ofxDmxUsbPro::init() {
+	if (serial.setLowLatency())
+		ofLogVerbose("ofxDmxUsbPro") << "Enabled low latency mode";
 	requestWidgetParameters();
 	bool r = waitForReply(LABEL_GET_WIDGET_PARAMS);
 	if (r) {
 		memcpy(&widgetParameters, getData(), sizeof(widgetParameters));
+		updateDmxTiming();
 		ofLogVerbose("ofxDmxUsbPro") << "Serial device is a Dmx Usb Pro";
 	}
 	else {
@@ -64,107 +127,321 @@ bool ofxDmxUsbPro::init() {
 }
 
 void ofxDmxUsbPro::update() {
-	while(receiveMessage() >= 5) {
+	receiveMessage();
+	while (parser.next(received))
+		processMessage();
+	updateRdm();
+	flushDmx();
+}
 
-		uint8_t label = getLabel();
-		uint16_t length = getLength();
-		uint8_t * data = getData();
+void ofxDmxUsbPro::processMessage() {
+	uint8_t label = getLabel();
+	uint16_t length = getLength();
+	uint8_t * data = getData();
 
-		if (message[0] == DMX_START_CODE && data != nullptr) {
+	if (label == LABEL_GET_WIDGET_PARAMS && length >= sizeof(widgetParameters)) {
+		memcpy(&widgetParameters, data, sizeof(widgetParameters));
+		updateDmxTiming();
+	}
+	if (label == LABEL_PACKET_RECEIVED && length >= 2) {
+		uint8_t status = data[0];
+		uint8_t startCode = data[1];
+
+		if (startCode == 0) { // DMX
+			DmxData dmx;
+			dmx.data = data + 2;
+			dmx.size = length - 2;
+			if (statsEnabled)
+				stats.framesReceived++;
+			ofNotifyEvent(dmxReceived, dmx, this);
 
-			if (label == LABEL_GET_WIDGET_PARAMS && length >= sizeof(widgetParameters)) {
-				memcpy(&widgetParameters, data, sizeof(widgetParameters));
+			DmxChangedData changes;
+			memset(changes.changed, 0, sizeof(changes.changed));
+			changes.count = DmxUsbProApplyFrame(dmx.data, dmx.size, dmxInput, changes.changed);
+			dmxInputSize = MAX(dmxInputSize, MIN(dmx.size, 512));
+			if (changes.count > 0) {
+				changes.data = dmxInput;
+				changes.size = dmxInputSize;
+				ofNotifyEvent(dmxChanged, changes, this);
 			}
-			if (label == LABEL_PACKET_RECEIVED && length >= 2) {
-				uint8_t status = data[0];
-				uint8_t startCode = data[1];
-
-				if (startCode == 0) { // DMX
-					DmxData dmx;
-					dmx.data = data + 2;
-					dmx.size = length - 2;
-					ofNotifyEvent(dmxReceived, dmx, this);
-				}
-				if (startCode == SC_RDM) { // RDM
-					RdmMessage rdm(data + 1, length - 1);
-					if (rdm.validateChecksum())
-						ofNotifyEvent(rdmReceived, rdm, this);
-				}
-				if (startCode == 0xFE || startCode == 0xAA) { // RDM DISC_UNIQUE_BRANCH response
-					RdmUid uid;
-					if (RdmDecodeUid(data + 1, uid))
-						ofNotifyEvent(rdmDiscovered, uid, this);
-				}
+		}
+		if (startCode == SC_RDM) { // RDM
+			// Parse in place and only copy replies nobody is waiting for
+			RdmMessageView view(data + 1, length - 1);
+			if (!view.isValid() || !view.validateChecksum()) {
+				if (statsEnabled)
+					stats.rdmChecksumFailures++;
 			}
-			if (label == LABEL_DMX_CHANGED) {
-				cosData.resize(512);
-				uint8_t start_changed_byte_number = data[0];
-				uint8_t * changed_bit_array = data + 1;
-				uint8_t * changed_dmx_data_array = data + 6;
-				uint8_t changed_byte_index = 0;
-				for (uint8_t byte_index=0; byte_index<5; byte_index++) {
-					for (uint8_t bit_index=0; bit_index<8; bit_index++) {
-						if ((changed_bit_array[byte_index] >> bit_index) & 0x1) {
-							uint16_t i = start_changed_byte_number * 8 + byte_index * 8 + bit_index;
-							if (i < cosData.size())
-								cosData[i] = changed_dmx_data_array[changed_byte_index];
-							changed_byte_index ++;
-						}
-					}
+			else {
+				if (rdmCacheEnabled)
+					rdmCache.observe(view);
+				if (!matchRdm(view)) {
+					RdmMessage rdm(data + 1, length - 1);
+					ofNotifyEvent(rdmReceived, rdm, this);
 				}
-				DmxData dmx;
-				dmx.data = cosData.data();
-				dmx.size = cosData.size();
-				ofNotifyEvent(dmxReceived, dmx, this);
-			}
-			if (label == LABEL_GET_SERIAL && length == sizeof(serialNumber)) {
-				memcpy(&serialNumber, data, sizeof(serialNumber));
 			}
 		}
+		if (startCode == 0xFE || startCode == 0xAA) { // RDM DISC_UNIQUE_BRANCH response
+			RdmUid uid;
+			if (RdmDecodeUid(data + 1, length - 1, uid))
+				ofNotifyEvent(rdmDiscovered, uid, this);
+		}
+	}
+	if (label == LABEL_DMX_CHANGED && length >= 6) {
+		DmxChangedData changes;
+		memset(changes.changed, 0, sizeof(changes.changed));
+		changes.count = DmxUsbProDecodeChanges(data, length, dmxInput, changes.changed);
+		changes.data = dmxInput;
+		changes.size = dmxInputSize = 512;
+
+		DmxData dmx;
+		dmx.data = dmxInput;
+		dmx.size = 512;
+		if (statsEnabled)
+			stats.framesReceived++;
+		ofNotifyEvent(dmxReceived, dmx, this);
+		ofNotifyEvent(dmxChanged, changes, this);
+	}
+	if (label == LABEL_GET_SERIAL && length == sizeof(serialNumber)) {
+		memcpy(&serialNumber, data, sizeof(serialNumber));
 	}
 }
 
 void ofxDmxUsbPro::requestWidgetParameters() {
-	uint8_t * data = prepareMessage(LABEL_GET_WIDGET_PARAMS, 2);
-	data[0] = 0;
-	data[1] = 0;
-	sendMessage();
+	uint8_t data[2] = { 0, 0 };
+	writePacket(LABEL_GET_WIDGET_PARAMS, data, sizeof(data));
 }
 
 void ofxDmxUsbPro::setWidgetParameters(uint8_t breakTime, uint8_t mabTime, uint8_t refreshRate) {
-	uint8_t * data = prepareMessage(LABEL_SET_WIDGET_PARAMS, 5);
-	data[0] = 0;
-	data[1] = 0;
-	data[2] = breakTime;
-	data[3] = mabTime;
-	data[4] = refreshRate;
-	sendMessage();
+	uint8_t data[5] = { 0, 0, breakTime, mabTime, refreshRate };
+	writePacket(LABEL_SET_WIDGET_PARAMS, data, sizeof(data));
+	widgetParameters.BreakTime = breakTime;
+	widgetParameters.MaBTime = mabTime;
+	widgetParameters.RefreshRate = refreshRate;
+	updateDmxTiming();
 }
 
 void ofxDmxUsbPro::requestSerialNumber() {
-	prepareMessage(LABEL_GET_SERIAL, 0);
-	sendMessage();
+	writePacket(LABEL_GET_SERIAL, nullptr, 0);
 }
 
 void ofxDmxUsbPro::sendDmx(uint8_t * dmx, size_t length, uint16_t channel) {
-	size_t size = channel + length;
-	if (length < 24)
-		size = 24;
-	if (size > 512) {
-		size = 512;
+	if (channel >= 512)
+		return;
+	if (channel + length > 512)
 		length = 512 - channel;
+
+	{
+		ofScopedLock lock(dmxMutex);
+		uint16_t end = channel + length;
+		if (memcmp(dmxUniverse + channel, dmx, length) != 0) {
+			memcpy(dmxUniverse + channel, dmx, length);
+			dmxDirtyLow = MIN(dmxDirtyLow, channel);
+			dmxDirtyHigh = MAX(dmxDirtyHigh, end);
+		}
+		if (dmxFading)
+			dmxFader.stop(channel, length, dmxUniverse);
+		if (end > dmxLength) {
+			// A longer frame has to go out even if the new channels are zero
+			dmxDirtyLow = MIN(dmxDirtyLow, dmxLength);
+			dmxDirtyHigh = MAX(dmxDirtyHigh, end);
+			dmxLength = end;
+		}
+	}
+	// Writes right away like before the universe was kept, unless the app
+	// collects changes itself or a thread or pool takes care of sending
+	if (!dmxBatching && !isThreadRunning() && !dmxPooled)
+		flushDmx();
+}
+
+void ofxDmxUsbPro::setDmxBatching(bool batching) {
+	dmxBatching = batching;
+}
+
+bool ofxDmxUsbPro::getDmxBatching() {
+	return dmxBatching;
+}
+
+void ofxDmxUsbPro::flushDmx() {
+	ofScopedLock lock(dmxMutex);
+	if (dmxLength == 0 || dmxPooled)
+		return;
+	if (dmxFading && !isThreadRunning())
+		updateDmxFades(ofGetElapsedTimeMicros());
+
+	bool dirty = dmxDirtyLow < dmxDirtyHigh;
+	if (isThreadRunning()) {
+		// The thread takes care of keep-alive frames
+		if (dirty) {
+			writeDmxFrame(frames[frameFront]);
+			frameFront = frameSwap.exchange(frameFront | FRAME_NEW) & FRAME_INDEX;
+		}
+	}
+	else {
+		uint64_t now = ofGetElapsedTimeMicros();
+		if (!dirty && (dmxKeepAliveMillis == 0 || now - dmxLastSendMicros < dmxKeepAliveMillis * 1000))
+			return;
+		// Frames sent faster than the widget puts them on the line would only
+		// pile up in its buffer, keep the changes for a later update instead
+		if (dmxLastSendMicros > 0 && now - dmxLastSendMicros < getDmxOutputMicros(dmxLength))
+			return;
+		// Send straight from the universe, it is locked until the write is
+		// done. Only a transform needs a frame of its own.
+		size_t size = MAX(dmxLength, 24);
+		if (dmxTransform.isIdentity()) {
+			uint8_t header[5] = { DMX_START_CODE, LABEL_SEND_DMX, (uint8_t)((size + 1) & 0xFF), (uint8_t)((size + 1) >> 8), 0 };
+			uint8_t end = DMX_END_CODE;
+			DmxUsbProCommand command;
+			DmxUsbProQueue::init(command, header, sizeof(header));
+			command.buffers[1] = { dmxUniverse, size };
+			command.buffers[2] = { &end, 1 };
+			command.count = 3;
+			submit(command);
+		}
+		else {
+			DmxFrame frame;
+			writeDmxFrame(frame);
+			writeBytes(frame.packet, frame.size);
+		}
+		dmxLastSendMicros = now;
+	}
+	dmxDirtyLow = 512;
+	dmxDirtyHigh = 0;
+}
+
+void ofxDmxUsbPro::fadeDmx(uint8_t * dmx, size_t length, uint64_t fadeMillis, uint16_t channel) {
+	if (channel >= 512)
+		return;
+	if (channel + length > 512)
+		length = 512 - channel;
+
+	ofScopedLock lock(dmxMutex);
+	uint16_t end = channel + length;
+	if (end > dmxLength) {
+		dmxDirtyLow = MIN(dmxDirtyLow, dmxLength);
+		dmxLength = end;
+	}
+	dmxFader.fade(dmx, length, channel, dmxUniverse, fadeMillis * 1000, ofGetElapsedTimeMicros());
+	dmxFading = dmxFader.isActive();
+	dmxDirtyLow = MIN(dmxDirtyLow, channel);
+	dmxDirtyHigh = MAX(dmxDirtyHigh, end);
+}
+
+bool ofxDmxUsbPro::isDmxFading() {
+	return dmxFading;
+}
+
+void ofxDmxUsbPro::updateDmxFades(uint64_t micros) {
+	// Called with dmxMutex locked
+	uint16_t low, high;
+	if (!dmxFader.update(micros, dmxUniverse, low, high))
+		return;
+	high = MIN(high, dmxLength);
+	if (low < high) {
+		dmxDirtyLow = MIN(dmxDirtyLow, low);
+		dmxDirtyHigh = MAX(dmxDirtyHigh, high);
+	}
+	dmxFading = dmxFader.isActive();
+}
+
+uint64_t ofxDmxUsbPro::getDmxReadyMicros() {
+	// The output thread and a pool pace frames themselves
+	ofScopedLock lock(dmxMutex);
+	if (isThreadRunning() || dmxPooled || dmxLastSendMicros == 0)
+		return 0;
+	return dmxLastSendMicros + getDmxOutputMicros(dmxLength);
+}
+
+bool ofxDmxUsbPro::takeDmxFrame(DmxFrame & frame, uint64_t micros) {
+	ofScopedLock lock(dmxMutex);
+	if (dmxLength == 0)
+		return false;
+	if (dmxFading)
+		updateDmxFades(micros);
+	bool dirty = dmxDirtyLow < dmxDirtyHigh;
+	if (!dirty && (dmxKeepAliveMillis == 0 || micros - dmxLastSendMicros < dmxKeepAliveMillis * 1000))
+		return false;
+	writeDmxFrame(frame);
+	dmxDirtyLow = 512;
+	dmxDirtyHigh = 0;
+	dmxLastSendMicros = micros;
+	return true;
+}
+
+void ofxDmxUsbPro::setDmxKeepAlive(uint64_t millis) {
+	dmxKeepAliveMillis = millis;
+}
+
+uint64_t ofxDmxUsbPro::getDmxFrameMicros(size_t channels) {
+	// Break and mark after break, then 44 us per slot including the start code
+	uint64_t micros = dmxBreakMicros + dmxMabMicros + (MAX(channels, 24) + 1) * 44;
+	uint8_t refreshRate = dmxRefreshRate;
+	if (refreshRate > 0)
+		micros = MAX(micros, 1000000 / refreshRate);
+	return micros;
+}
+
+float ofxDmxUsbPro::getDmxFrameRate() {
+	return 1000000.f / getDmxOutputMicros(dmxLength);
+}
+
+uint64_t ofxDmxUsbPro::getDmxOutputMicros(size_t channels) {
+	uint64_t micros = getDmxFrameMicros(channels);
+	if (isThreadRunning() && threadFrameRate > 0)
+		micros = MAX(micros, (uint64_t)(1000000 / threadFrameRate));
+	return micros;
+}
+
+void ofxDmxUsbPro::setDmxTransform(const DmxTransform & transform) {
+	ofScopedLock lock(dmxMutex);
+	dmxTransform = transform;
+	// Everything goes out again with the new curves
+	if (dmxLength > 0) {
+		dmxDirtyLow = 0;
+		dmxDirtyHigh = dmxLength;
+	}
+}
+
+DmxTransform ofxDmxUsbPro::getDmxTransform() {
+	ofScopedLock lock(dmxMutex);
+	return dmxTransform;
+}
+
+void ofxDmxUsbPro::sendDmx16(const uint16_t * values, size_t count, uint16_t channel) {
+	uint8_t dmx[512];
+	count = MIN(count, 256);
+	for (size_t i=0; i<count; i++) {
+		dmx[2 * i] = values[i] >> 8;
+		dmx[2 * i + 1] = values[i] & 0xFF;
 	}
+	sendDmx(dmx, 2 * count, channel);
+}
+
+void ofxDmxUsbPro::updateDmxTiming() {
+	// Break and mark after break are set in units of 10.67 us
+	if (widgetParameters.BreakTime > 0)
+		dmxBreakMicros = widgetParameters.BreakTime * 1067 / 100;
+	if (widgetParameters.MaBTime > 0)
+		dmxMabMicros = widgetParameters.MaBTime * 1067 / 100;
+	dmxRefreshRate = widgetParameters.RefreshRate;
+}
 
-	uint8_t * data = prepareMessage(LABEL_SEND_DMX, size + 1);
-	data[0] = 0;
-	memcpy(data + 1 + channel, dmx, length);
-	sendMessage();
+void ofxDmxUsbPro::writeDmxFrame(DmxFrame & frame) {
+	// The widget needs at least 24 channels per frame
+	size_t size = MAX(dmxLength, 24);
+	uint8_t * packet = frame.packet;
+	packet[0] = DMX_START_CODE;
+	packet[1] = LABEL_SEND_DMX;
+	packet[2] = (size + 1) & 0xFF;
+	packet[3] = ((size + 1) >> 8) & 0xFF;
+	packet[4] = 0;
+	dmxTransform.apply(dmxUniverse, packet + 5, size);
+	packet[size + 5] = DMX_END_CODE;
+	frame.size = size + 6;
 }
 
 void ofxDmxUsbPro::sendRdm(uint8_t * rdm, size_t length) {
-	uint8_t * data = prepareMessage(LABEL_SEND_RDM, length);
-	memcpy(data, rdm, length);
-	sendMessage();
+	writePacket(LABEL_SEND_RDM, rdm, length);
 }
 
 void ofxDmxUsbPro::sendRdm(RdmMessage & rdm) {
@@ -175,9 +452,8 @@ void ofxDmxUsbPro::sendRdm(RdmMessage & rdm) {
 }
 
 void ofxDmxUsbPro::setReceiveDmxOnChange(bool dmxChangeOnly) {
-	uint8_t * data = prepareMessage(LABEL_SET_DMX_CHANGE, 1);
-	data[0] = dmxChangeOnly ? 1 : 0;
-	sendMessage();
+	uint8_t data = dmxChangeOnly ? 1 : 0;
+	writePacket(LABEL_SET_DMX_CHANGE, &data, 1);
 }
 
 void ofxDmxUsbPro::sendRdmDiscovery(const RdmUid & from, const RdmUid & to) {
@@ -186,27 +462,15 @@ void ofxDmxUsbPro::sendRdmDiscovery(const RdmUid & from, const RdmUid & to) {
 	msg.setSource(getUid());
 	msg.setTransactionNumber(rdmTransactionNumber++);
 	msg.updateChecksum();
-	prepareMessage(LABEL_SEND_RDM_DISC, msg.getPacketSize());
-	memcpy(getData(), msg.getPacket(), msg.getPacketSize());
-	sendMessage();
+	writePacket(LABEL_SEND_RDM_DISC, msg.getPacket(), msg.getPacketSize());
 }
 
 bool ofxDmxUsbPro::getRdm(RdmMessage & send, RdmMessage & reply) {
-	sendRdm(send);
-	ofSleepMillis(1);
-	if (waitForReply(LABEL_PACKET_RECEIVED)) {
-		uint8_t * data = getData();
-		uint8_t status = data[0];
-		uint8_t startCode = data[1];
-		if (status == 0 && startCode == SC_RDM) {
-			reply.setPacket(data + 1, getLength() - 1);
-			return reply.validateChecksum() && reply.getTransactionNumber() == send.getTransactionNumber() && reply.getParameterID() == send.getParameterID();
-		}
-	}
-	else
-		ofLogWarning() << "REPLY TIMED OUT";
-
-	return false;
+	RdmTransaction transaction;
+	bool r = waitForRdm(send, transaction);
+	send = transaction.request;
+	reply = transaction.reply;
+	return r;
 }
 
 bool ofxDmxUsbPro::getRdm(RdmUid & uid, uint16_t pid, RdmMessage & reply) {
@@ -214,49 +478,518 @@ bool ofxDmxUsbPro::getRdm(RdmUid & uid, uint16_t pid, RdmMessage & reply) {
 	return getRdm(send, reply);
 }
 
+bool ofxDmxUsbPro::getRdm(RdmUid & uid, uint16_t pid, vector<uint8_t> & data) {
+	RdmMessage send(uid, GET_COMMAND, pid);
+	RdmTransaction transaction;
+	if (!waitForRdm(send, transaction) || transaction.status != RDM_ACK)
+		return false;
+	data.assign(transaction.getData(), transaction.getData() + transaction.getDataLength());
+	return true;
+}
+
+bool ofxDmxUsbPro::waitForRdm(RdmMessage & send, RdmTransaction & transaction, uint64_t timeOutMicros) {
+	transaction.status = RDM_PENDING;
+	transaction.request = send;
+	uint32_t id = queueRdm(send, [&](RdmTransaction & result) {
+		transaction = std::move(result);
+	}, timeOutMicros);
+	updateRdm();
+	while (transaction.status == RDM_PENDING && serial.isInitialized()) {
+		pollRdm();
+		if (transaction.status == RDM_PENDING)
+			waitForInput(getRdmWaitMicros());
+	}
+	if (transaction.status == RDM_PENDING)
+		cancelRdm(id);
+	if (transaction.status == RDM_TIMEOUT)
+		ofLogWarning("ofxDmxUsbPro") << "RDM reply timed out";
+
+	RdmStatus status = transaction.status;
+	return status == RDM_ACK || status == RDM_ACK_TIMER || status == RDM_NACK || status == RDM_ACK_OVERFLOW;
+}
+
 bool ofxDmxUsbPro::getRdmDiscovery(const RdmUid & from, const RdmUid & to, vector<RdmUid>& deviceUids) {
-	sendRdmDiscovery(from, to);
-	vector<RdmUid> uids;
-	while (waitForReply(LABEL_PACKET_RECEIVED)) {
-		uint8_t * data = getData();
-		if (data[0] == 0) {
-			RdmUid uid;
-			if (RdmDecodeUid(data + 1, uid)) {
-				uids.push_back(uid);
+	typedef struct {
+		uint64_t lower;
+		uint64_t upper;
+	} Branch;
+
+	size_t numFound = deviceUids.size();
+	vector<Branch> stack;
+	stack.push_back({ RdmUidToUint64(from), RdmUidToUint64(to) });
+	while (!stack.empty() && serial.isInitialized()) {
+		Branch branch = stack.back();
+		stack.pop_back();
+
+		sendRdmDiscovery(RdmUidFromUint64(branch.lower), RdmUidFromUint64(branch.upper));
+		RdmUid uid;
+		RdmDiscoveryResult result = waitForDiscovery(uid);
+		if (result == RDM_DISCOVERY_NONE)
+			continue;
+
+		if (result == RDM_DISCOVERY_FOUND) {
+			uint64_t id = RdmUidToUint64(uid);
+			bool known = find_if(deviceUids.begin() + numFound, deviceUids.end(), [id](const RdmUid & found) {
+				return RdmUidToUint64(found) == id;
+			}) != deviceUids.end();
+
+			if (!known && id >= branch.lower && id <= branch.upper) {
+				// Only trust the UID once the device has confirmed it by muting.
+				// The mute uses the short discovery timeout as well.
+				RdmMessage mute(uid, DISCOVERY_COMMAND, DISC_MUTE);
+				RdmTransaction transaction;
+				if (waitForRdm(mute, transaction, rdmDiscoveryTimeoutMicros)) {
+					deviceUids.push_back(uid);
+					ofNotifyEvent(rdmDiscovered, uid, this);
+					// There may be more devices in the same branch
+					stack.push_back(branch);
+					continue;
+				}
 			}
 		}
+
+		// Collision, or a response that could not be confirmed
+		if (branch.lower < branch.upper) {
+			uint64_t mid = branch.lower + (branch.upper - branch.lower) / 2;
+			stack.push_back({ mid + 1, branch.upper });
+			stack.push_back({ branch.lower, mid });
+		}
 	}
-	if (uids.size() == 1) {
-		RdmMessage mute(uids[0], DISCOVERY_COMMAND, DISC_MUTE);
-		RdmMessage reply;
-		if (getRdm(mute, reply)) {
-			uint16_t control = reply.getDataAsUint16();
+
+	return deviceUids.size() > numFound;
+}
+
+bool ofxDmxUsbPro::getRdmDiscoveryFull(vector<RdmUid>& deviceUids) {
+	RdmMessage unmute(RdmAllDevicesUid(), DISCOVERY_COMMAND, DISC_UN_MUTE);
+	RdmMessage reply;
+	getRdm(unmute, reply);
+	bool found = getRdmDiscovery(RdmZeroUid(), RdmAllDevicesUid(), deviceUids);
+	// Anything not found any more is gone from the line
+	if (rdmCacheEnabled)
+		rdmCache.retain(deviceUids);
+	return found;
+}
+
+void ofxDmxUsbPro::setRdmDiscoveryTimeout(uint64_t timeOutMicros) {
+	rdmDiscoveryTimeoutMicros = timeOutMicros;
+}
+
+uint32_t ofxDmxUsbPro::sendRdmAsync(RdmMessage & rdm, RdmCallback callback) {
+	uint32_t id = queueRdm(rdm, callback);
+	updateRdm();
+	return id;
+}
+
+uint32_t ofxDmxUsbPro::queueRdm(RdmMessage & rdm, RdmCallback callback, uint64_t timeOutMicros) {
+	RdmPending pending;
+	pending.transaction.id = rdmNextId++;
+	pending.transaction.status = RDM_PENDING;
+	pending.transaction.request = rdm;
+	pending.transaction.attempts = 0;
+	pending.transaction.latencyMicros = 0;
+	pending.callback = callback;
+	pending.sentMicros = 0;
+	pending.startMicros = 0;
+	pending.dueMicros = 0;
+	pending.transactionNumber = 0;
+	pending.tries = 0;
+	pending.polls = 0;
+	pending.queued = false;
+	pending.timeoutMicros = timeOutMicros;
+	uint32_t id = pending.transaction.id;
+	rdmQueue.push_back(std::move(pending));
+	return id;
+}
+
+std::future<RdmTransaction> ofxDmxUsbPro::getRdmAsync(RdmMessage & rdm) {
+	shared_ptr<std::promise<RdmTransaction>> promise = make_shared<std::promise<RdmTransaction>>();
+	sendRdmAsync(rdm, [promise](RdmTransaction & transaction) {
+		promise->set_value(transaction);
+	});
+	return promise->get_future();
+}
+
+std::future<RdmTransaction> ofxDmxUsbPro::getRdmAsync(const RdmUid & uid, uint16_t pid) {
+	RdmMessage send(uid, GET_COMMAND, pid);
+	return getRdmAsync(send);
+}
+
+void ofxDmxUsbPro::cancelRdm(uint32_t id) {
+	for (size_t i=0; i<rdmQueue.size(); i++) {
+		if (rdmQueue[i].transaction.id == id) {
+			RdmPending pending = std::move(rdmQueue[i]);
+			rdmQueue.erase(rdmQueue.begin() + i);
+			finishRdm(pending, RDM_CANCELLED);
+			return;
 		}
-		deviceUids.push_back(reply.getSource());
-		return true;
 	}
-	else if (uids.size() > 1) {
-		uint64_t mid = (RdmUidToUint64(from) + RdmUidToUint64(to)) / 2;
-		RdmUid midLow = RdmUidFromUint64(mid);
-		RdmUid midHigh = RdmUidFromUint64(mid + 1);
-		getRdmDiscovery(from, midLow, deviceUids);
-		getRdmDiscovery(midHigh, to, deviceUids);
+	for (size_t i=0; i<rdmInFlight.size(); i++) {
+		if (rdmInFlight[i].transaction.id == id) {
+			RdmPending pending = std::move(rdmInFlight[i]);
+			rdmInFlight.erase(rdmInFlight.begin() + i);
+			finishRdm(pending, RDM_CANCELLED);
+			return;
+		}
+	}
+	for (size_t i=0; i<rdmWaiting.size(); i++) {
+		if (rdmWaiting[i].transaction.id == id) {
+			RdmPending pending = std::move(rdmWaiting[i]);
+			rdmWaiting.erase(rdmWaiting.begin() + i);
+			finishRdm(pending, RDM_CANCELLED);
+			return;
+		}
+	}
+}
+
+void ofxDmxUsbPro::cancelAllRdm() {
+	vector<shared_ptr<RdmBatch>> batches;
+	batches.swap(rdmBatches);
+	for (shared_ptr<RdmBatch> & batch : batches)
+		batch->cancel();
+
+	deque<RdmPending> queue;
+	vector<RdmPending> inFlight;
+	vector<RdmPending> waiting;
+	queue.swap(rdmQueue);
+	inFlight.swap(rdmInFlight);
+	waiting.swap(rdmWaiting);
+	for (RdmPending & pending : inFlight)
+		finishRdm(pending, RDM_CANCELLED);
+	for (RdmPending & pending : waiting)
+		finishRdm(pending, RDM_CANCELLED);
+	for (RdmPending & pending : queue)
+		finishRdm(pending, RDM_CANCELLED);
+	for (shared_ptr<RdmBatch> & batch : batches)
+		batch->cancelRemaining();
+}
+
+void ofxDmxUsbPro::sendRdmBatch(shared_ptr<RdmBatch> batch) {
+	if (!batch || batch->isDone())
+		return;
+	rdmBatches.push_back(batch);
+	updateRdm();
+}
+
+bool ofxDmxUsbPro::getRdmBatch(RdmBatch & batch) {
+	// The batch lives on the caller's side and is removed again before
+	// returning, so the engine may hold it without owning it
+	sendRdmBatch(shared_ptr<RdmBatch>(&batch, [](RdmBatch *) {}));
+	while (!batch.isDone() && serial.isInitialized()) {
+		pollRdm();
+		if (!batch.isDone())
+			waitForInput(getRdmWaitMicros());
+	}
+	if (!batch.isDone()) {
+		batch.cancel();
+		updateRdmBatches();
+	}
+	return !batch.isCancelled();
+}
+
+size_t ofxDmxUsbPro::getNumRdmPending() {
+	return rdmQueue.size() + rdmInFlight.size() + rdmWaiting.size();
+}
+
+void ofxDmxUsbPro::setRdmTimeout(uint64_t timeOutMicros) {
+	rdmTimeoutMicros = timeOutMicros;
+}
+
+void ofxDmxUsbPro::setRdmRetries(uint8_t retries) {
+	rdmRetries = retries;
+}
+
+void ofxDmxUsbPro::setRdmMaxInFlight(size_t maxInFlight) {
+	rdmMaxInFlight = MAX(maxInFlight, 1);
+}
+
+void ofxDmxUsbPro::updateRdm() {
+	uint64_t now = ofGetElapsedTimeMicros();
+
+	// Retry or give up on requests that timed out
+	for (size_t i=0; i<rdmInFlight.size();) {
+		RdmPending & pending = rdmInFlight[i];
+		if (now - pending.sentMicros < getRdmTimeout(pending)) {
+			i++;
+			continue;
+		}
+		RdmPending expired = std::move(pending);
+		rdmInFlight.erase(rdmInFlight.begin() + i);
+		if (statsEnabled)
+			stats.rdmTimeouts++;
+		if (expired.tries <= rdmRetries)
+			rdmQueue.push_front(std::move(expired));
+		else
+			finishRdm(expired, RDM_TIMEOUT);
+	}
+
+	// Collect replies the devices asked for more time for
+	for (size_t i=0; i<rdmWaiting.size();) {
+		if (now < rdmWaiting[i].dueMicros) {
+			i++;
+			continue;
+		}
+		rdmQueue.push_front(std::move(rdmWaiting[i]));
+		rdmWaiting.erase(rdmWaiting.begin() + i);
+	}
+
+	updateRdmBatches();
+
+	// Keep the line busy
+	while (!rdmQueue.empty() && rdmInFlight.size() < rdmMaxInFlight && serial.isInitialized()) {
+		RdmPending pending = std::move(rdmQueue.front());
+		rdmQueue.pop_front();
+		if (rdmCacheEnabled && !pending.queued && rdmCache.getReply(pending.transaction, getUid())) {
+			// Nothing went on the line, so a batch may have the next one ready
+			finishRdm(pending, RDM_ACK);
+			updateRdmBatches();
+			continue;
+		}
+		transmitRdm(pending);
+		if (RdmIsBroadcast(pending.transaction.request.getDestination()))
+			finishRdm(pending, RDM_BROADCAST);
+		else
+			rdmInFlight.push_back(std::move(pending));
+	}
+}
+
+void ofxDmxUsbPro::updateRdmBatches() {
+	for (size_t i=0; i<rdmBatches.size();) {
+		shared_ptr<RdmBatch> batch = rdmBatches[i];
+		if (batch->isCancelled()) {
+			vector<uint32_t> active = batch->active;
+			for (uint32_t id : active)
+				cancelRdm(id);
+			batch->cancelRemaining();
+		}
+
+		// Only queue as much as the line takes at once, so cancelling stays
+		// cheap. Requests waiting for a queued reply leave the line free.
+		size_t index;
+		while (rdmQueue.size() + rdmInFlight.size() < rdmMaxInFlight && batch->nextRequest(index)) {
+			RdmMessage request;
+			batch->getRequest(index, request);
+			uint32_t id = queueRdm(request, [batch, index](RdmTransaction & transaction) {
+				batch->finishRequest(index, transaction);
+			});
+			batch->active.push_back(id);
+		}
+
+		if (batch->isDone())
+			rdmBatches.erase(rdmBatches.begin() + i);
+		else
+			i++;
+	}
+}
+
+void ofxDmxUsbPro::pollRdm() {
+	receiveMessage();
+	while (parser.next(received))
+		processMessage();
+	updateRdm();
+}
+
+uint64_t ofxDmxUsbPro::getRdmWaitMicros() {
+	// Time until the oldest request in flight times out
+	uint64_t now = ofGetElapsedTimeMicros();
+	uint64_t wait = rdmTimeoutMicros;
+	for (RdmPending & pending : rdmInFlight) {
+		uint64_t elapsed = now - pending.sentMicros;
+		uint64_t timeOutMicros = getRdmTimeout(pending);
+		if (elapsed >= timeOutMicros)
+			return 0;
+		wait = MIN(wait, timeOutMicros - elapsed);
+	}
+	// or a queued message is due
+	for (RdmPending & pending : rdmWaiting) {
+		if (pending.dueMicros <= now)
+			return 0;
+		wait = MIN(wait, pending.dueMicros - now);
+	}
+	return wait;
+}
+
+uint64_t ofxDmxUsbPro::getRdmTimeout(const RdmPending & pending) {
+	return pending.timeoutMicros > 0 ? pending.timeoutMicros : rdmTimeoutMicros;
+}
+
+void ofxDmxUsbPro::transmitRdm(RdmPending & pending) {
+	// Every attempt gets a new transaction number so a late reply to an
+	// earlier attempt is not mistaken for the current one
+	if (pending.queued) {
+		RdmMessage poll(pending.transaction.request.getDestination(), GET_COMMAND, QUEUED_MESSAGE);
+		uint8_t statusType = STATUS_ERROR;
+		poll.setData(&statusType, 1);
+		sendRdm(poll);
+		pending.transactionNumber = poll.getTransactionNumber();
+	}
+	else {
+		sendRdm(pending.transaction.request);
+		pending.transactionNumber = pending.transaction.request.getTransactionNumber();
+	}
+	pending.transaction.attempts++;
+	pending.tries++;
+	pending.sentMicros = ofGetElapsedTimeMicros();
+	if (pending.startMicros == 0)
+		pending.startMicros = pending.sentMicros;
+}
+
+void ofxDmxUsbPro::waitRdm(RdmPending & pending, uint64_t micros) {
+	pending.queued = true;
+	pending.tries = 0;
+	pending.polls++;
+	pending.dueMicros = ofGetElapsedTimeMicros() + micros;
+	rdmWaiting.push_back(std::move(pending));
+}
+
+bool ofxDmxUsbPro::matchRdm(const RdmMessageView & reply) {
+	for (size_t i=0; i<rdmInFlight.size(); i++) {
+		RdmPending & candidate = rdmInFlight[i];
+		RdmMessage & request = candidate.transaction.request;
+		if (reply.getTransactionNumber() != candidate.transactionNumber)
+			continue;
+		bool matches = reply.getParameterID() == request.getParameterID() &&
+			reply.getCommandClass() == request.getCommandClass() + 1;
+		// A device polled for a queued reply sends something else when the
+		// reply is not ready yet: its status messages, or other queued messages
+		if (!matches && !candidate.queued)
+			continue;
+
+		RdmPending pending = std::move(candidate);
+		rdmInFlight.erase(rdmInFlight.begin() + i);
+		uint64_t now = ofGetElapsedTimeMicros();
+		if (statsEnabled)
+			stats.rdmLatency[pending.transaction.request.getParameterID()].add(now - pending.sentMicros);
+
+		if (!matches) {
+			if (pending.polls < RDM_MAX_QUEUED_POLLS)
+				waitRdm(pending, RDM_QUEUED_POLL_INTERVAL);
+			else
+				finishRdm(pending, RDM_ACK_TIMER);
+			updateRdm();
+			return reply.getParameterID() == STATUS_MESSAGES;
+		}
+
+		pending.transaction.reply.setPacket(reply.getPacket(), reply.getPacketSize());
+		pending.transaction.latencyMicros = now - pending.startMicros;
+		vector<uint8_t> & data = pending.transaction.data;
+		switch (reply.getResponseType()) {
+			case RESPONSE_TYPE_ACK_OVERFLOW:
+				// Ask again for the next part, appending them all in one buffer
+				if (data.empty())
+					data.reserve(RDM_MAX_OVERFLOW_SIZE);
+				if (data.size() + reply.getDataLength() > RDM_MAX_OVERFLOW_SIZE) {
+					finishRdm(pending, RDM_ACK_OVERFLOW);
+					break;
+				}
+				data.insert(data.end(), reply.getDataBytes(), reply.getDataBytes() + reply.getDataLength());
+				pending.tries = 0;
+				rdmQueue.push_front(std::move(pending));
+				break;
+			case RESPONSE_TYPE_ACK_TIMER: {
+				// Come back for the reply with QUEUED_MESSAGE once it is ready
+				uint64_t wait = reply.getDataLength() >= 2 ? reply.getDataAsUint16() * 100000ULL : RDM_QUEUED_POLL_INTERVAL;
+				if (pending.polls < RDM_MAX_QUEUED_POLLS)
+					waitRdm(pending, wait);
+				else
+					finishRdm(pending, RDM_ACK_TIMER);
+				break;
+			}
+			case RESPONSE_TYPE_NACK_REASON:
+				data.clear();
+				finishRdm(pending, RDM_NACK);
+				break;
+			default:
+				if (!data.empty())
+					data.insert(data.end(), reply.getDataBytes(), reply.getDataBytes() + reply.getDataLength());
+				finishRdm(pending, RDM_ACK);
+		}
+		updateRdm();
+		return true;
 	}
 	return false;
 }
 
-bool ofxDmxUsbPro::getRdmDiscoveryFull(vector<RdmUid>& deviceUids) {
-	RdmMessage unmute(RdmAllDevicesUid(), DISCOVERY_COMMAND, DISC_UN_MUTE);
-	sendRdm(unmute);
-	ofSleepMillis(1);
-	waitForReply(LABEL_PACKET_RECEIVED);
-	return getRdmDiscovery(RdmZeroUid(), RdmAllDevicesUid(), deviceUids);
+void ofxDmxUsbPro::finishRdm(RdmPending & pending, RdmStatus status) {
+	pending.transaction.status = status;
+	// Replies answered from the cache never went on the line
+	if (rdmCacheEnabled && status == RDM_ACK && pending.transaction.attempts > 0)
+		rdmCache.store(pending.transaction);
+	if (pending.callback)
+		pending.callback(pending.transaction);
+}
+
+void ofxDmxUsbPro::setRdmCacheEnabled(bool enabled) {
+	rdmCacheEnabled = enabled;
+}
+
+bool ofxDmxUsbPro::getRdmCacheEnabled() {
+	return rdmCacheEnabled;
+}
+
+RdmDeviceCache & ofxDmxUsbPro::getRdmCache() {
+	return rdmCache;
+}
+
+void ofxDmxUsbPro::setStatsEnabled(bool enabled) {
+	if (enabled && !statsEnabled)
+		resetStats();
+	statsEnabled = enabled;
+}
+
+bool ofxDmxUsbPro::getStatsEnabled() {
+	return statsEnabled;
+}
+
+DmxUsbProStats ofxDmxUsbPro::getStats() {
+	DmxUsbProStats snapshot;
+	{
+		ofScopedLock lock(mutex);
+		snapshot = stats;
+	}
+	snapshot.parserResyncs = parser.getResyncCount() - statsResyncOffset;
+
+	// Rates cover the time since the previous snapshot
+	uint64_t now = ofGetElapsedTimeMicros();
+	float seconds = (now - statsLastMicros) / 1000000.f;
+	if (seconds > 0) {
+		snapshot.framesSentPerSecond = (snapshot.framesSent - statsLastFramesSent) / seconds;
+		snapshot.framesReceivedPerSecond = (snapshot.framesReceived - statsLastFramesReceived) / seconds;
+	}
+	snapshot.targetFrameRate = getDmxFrameRate();
+	statsLastMicros = now;
+	statsLastFramesSent = snapshot.framesSent;
+	statsLastFramesReceived = snapshot.framesReceived;
+	return snapshot;
+}
+
+void ofxDmxUsbPro::resetStats() {
+	ofScopedLock lock(mutex);
+	stats.framesSent = 0;
+	stats.framesReceived = 0;
+	stats.framesSentPerSecond = 0;
+	stats.framesReceivedPerSecond = 0;
+	stats.bytesWritten = 0;
+	stats.targetFrameRate = 0;
+	stats.writeDuration.clear();
+	stats.frameInterval.clear();
+	stats.frameJitter.clear();
+	stats.rdmLatency.clear();
+	stats.rdmTimeouts = 0;
+	stats.rdmChecksumFailures = 0;
+	stats.parserResyncs = 0;
+	stats.waitDuration.clear();
+	statsResyncOffset = parser.getResyncCount();
+	statsLastMicros = ofGetElapsedTimeMicros();
+	statsLastFramesSent = 0;
+	statsLastFramesReceived = 0;
+	statsLastFrameMicros = 0;
 }
 
 void ofxDmxUsbPro::getWidgetParameters() {
 	requestWidgetParameters();
 	if (waitForReply(LABEL_GET_WIDGET_PARAMS)) {
 		memcpy(&widgetParameters, getData(), sizeof(widgetParameters));
+		updateDmxTiming();
 		ofLogVerbose() << "Firmware version: " << (int)widgetParameters.FirmwareMSB << "." << (int)widgetParameters.FirmwareLSB;
 		ofLogVerbose() << "DMX output break time: " << (widgetParameters.BreakTime *  10.67f) << " micros (" << (int)widgetParameters.BreakTime << ")";
 		ofLogVerbose() << "DMX output Mark After Break time: " << (widgetParameters.MaBTime * 10.67f) << " micros (" << (int)widgetParameters.MaBTime << ")";
@@ -296,51 +1029,453 @@ RdmUid ofxDmxUsbPro::getUid() {
 	return uid;
 }
 
-uint8_t * ofxDmxUsbPro::prepareMessage(uint8_t label, size_t length) {
-	message.resize(length + 5);
-	message[0] = DMX_START_CODE;
-	message[1] = label;
-	message[2] = length & 0xFF;
-	message[3] = (length >> 8) & 0xFF;
-	message[length+4] = DMX_END_CODE;
-	return getData();
-}
-
 uint8_t ofxDmxUsbPro::getLabel() {
-	return message.size() < 2 ? 0 : message[1];
+	return received.label;
 }
 
 uint8_t * ofxDmxUsbPro::getData() {
-	return message.size() < 5 ? nullptr : &message[4];
+	return received.data;
 }
 
 uint16_t ofxDmxUsbPro::getLength() {
-	if (message.size() < 4)
-		return 0;
+	return received.length;
+}
+
+void ofxDmxUsbPro::writePacket(uint8_t label, const uint8_t * data, size_t length) {
+	if (!serial.isInitialized() || length > DMX_USB_PRO_MAX_PAYLOAD)
+		return;
+	DmxUsbProCommand command;
+	DmxUsbProQueue::init(command, label, data, length);
+	submit(command);
+}
+
+void ofxDmxUsbPro::writeBytes(const uint8_t * bytes, size_t size) {
+	if (!serial.isInitialized())
+		return;
+	DmxUsbProCommand command;
+	DmxUsbProQueue::init(command, bytes, size);
+	submit(command);
+}
+
+void ofxDmxUsbPro::submit(DmxUsbProCommand & command) {
+	commands.push(&command);
+	writeRequests++;
+	// The command lives on the caller's stack, so wait for whoever holds the
+	// writer flag to get to it. Trying again each round writes it here should
+	// the flag come free before the holder saw it.
+	for (int spins=0; ; spins++) {
+		writeCommands();
+		if (command.written.load())
+			return;
+		if (spins < WRITE_SPINS) {
+			std::this_thread::yield();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(writeMutex);
+		writeWaiters++;
+		writeCondition.wait_for(lock, std::chrono::milliseconds(1), [&] {
+			return command.written.load();
+		});
+		writeWaiters--;
+	}
+}
 
-	uint16_t length = message[2] | (message[3] << 8);
-	return MIN(length, MAX(0, message.size()-5));
+void ofxDmxUsbPro::writeCommands() {
+	// Whoever gets the writer flag writes everything queued so far, the
+	// others leave their packets to it. A packet submitted while the flag
+	// was taken is picked up by going round again.
+	for (;;) {
+		uint64_t requests = writeRequests;
+		if (writing.test_and_set())
+			return;
+		DmxUsbProCommand * batch[DMX_USB_PRO_MAX_BATCH];
+		size_t count;
+		do {
+			for (count=0; count<DMX_USB_PRO_MAX_BATCH; count++) {
+				batch[count] = commands.pop();
+				if (batch[count] == nullptr)
+					break;
+			}
+			if (count > 0)
+				writeBatch(batch, count);
+			// Hands the commands back, they may be gone right after this
+			for (size_t i=0; i<count; i++)
+				batch[i]->written = true;
+			notifyWriters();
+		} while (count == DMX_USB_PRO_MAX_BATCH);
+		// Sequentially consistent, so either this sees the count of a
+		// producer that just pushed or the producer sees the flag clear
+		writing.clear();
+		notifyWriters();
+		if (writeRequests == requests)
+			return;
+	}
 }
 
-void ofxDmxUsbPro::sendMessage() {
+void ofxDmxUsbPro::writeBatch(DmxUsbProCommand ** batch, size_t count) {
+	// Queued packets go out back to back in one write
+	DmxUsbProBuffer buffers[DMX_USB_PRO_MAX_BATCH * 3];
+	size_t numBuffers = 0;
+	size_t size = 0;
+	for (size_t i=0; i<count; i++) {
+		for (size_t j=0; j<batch[i]->count; j++) {
+			buffers[numBuffers++] = batch[i]->buffers[j];
+			size += batch[i]->buffers[j].size;
+		}
+	}
 	if (!serial.isInitialized())
 		return;
+	if (!statsEnabled) {
+		serial.writeBuffers(buffers, numBuffers);
+		return;
+	}
 
-	serial.writeBytes(message.data(), message.size());
+	uint64_t start = ofGetElapsedTimeMicros();
+	serial.writeBuffers(buffers, numBuffers);
+	uint64_t end = ofGetElapsedTimeMicros();
+	ofScopedLock lock(mutex);
+	stats.writeDuration.add(end - start);
+	stats.bytesWritten += size;
+	for (size_t i=0; i<count; i++) {
+		if (batch[i]->label == LABEL_SEND_DMX) {
+			if (stats.framesSent > 0)
+				stats.frameInterval.add(start - statsLastFrameMicros);
+			statsLastFrameMicros = start;
+			stats.framesSent++;
+		}
+	}
+}
+
+uint64_t ofxDmxUsbPro::writeFrame(const DmxFrame & frame) {
+	// Writes on this thread instead of leaving the frame to another writer,
+	// and returns when the write started rather than when it was queued
+	DmxUsbProCommand command;
+	DmxUsbProQueue::init(command, frame.packet, frame.size);
+	DmxUsbProCommand * batch = &command;
+	lockWriter();
+	uint64_t start = ofGetElapsedTimeMicros();
+	writeBatch(&batch, 1);
+	unlockWriter();
+	return start;
+}
+
+void ofxDmxUsbPro::lockWriter() {
+	for (int spins=0; writing.test_and_set(); spins++) {
+		if (spins < WRITE_SPINS) {
+			std::this_thread::yield();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(writeMutex);
+		writeWaiters++;
+		writeCondition.wait_for(lock, std::chrono::milliseconds(1));
+		writeWaiters--;
+	}
+}
+
+void ofxDmxUsbPro::unlockWriter() {
+	writing.clear();
+	notifyWriters();
+	// Packets submitted in the meantime were left to whoever held the flag
+	writeCommands();
+}
+
+void ofxDmxUsbPro::notifyWriters() {
+	// Only threads that gave up spinning need waking up
+	if (writeWaiters > 0) {
+		std::lock_guard<std::mutex> lock(writeMutex);
+		writeCondition.notify_all();
+	}
 }
 
 int ofxDmxUsbPro::receiveMessage() {
 	if (!serial.isInitialized())
 		return -1;
+	if (threadInput) {
+		// The bridge thread has already put everything into the parser
+		std::lock_guard<std::mutex> lock(inputMutex);
+		inputSeen = inputSequence;
+		return 0;
+	}
 	int n = serial.available();
-	if (n > 0) {
-		message.resize(n);
-		int r = serial.readBytes(message.data(), message.size());
-		if (r == n) {
-			return r;
+	int total = 0;
+	while (n > 0) {
+		// Read straight into the parser, in up to two pieces if the ring wraps
+		size_t contiguous;
+		uint8_t * dst = parser.getWritePointer(contiguous);
+		if (contiguous == 0)
+			break;
+		int r = serial.readBytes(dst, MIN((size_t)n, contiguous));
+		if (r <= 0)
+			break;
+		parser.commitWrite(r);
+		total += r;
+		n -= r;
+	}
+	return total;
+}
+
+bool ofxDmxUsbPro::waitForInput(uint64_t timeOutMicros) {
+	if (!threadInput)
+		return serial.waitForData(timeOutMicros);
+	// Anything read since the last receiveMessage() has not been parsed yet
+	std::unique_lock<std::mutex> lock(inputMutex);
+	return inputCondition.wait_for(lock, std::chrono::microseconds(timeOutMicros), [this] {
+		return inputSequence != inputSeen || !threadInput;
+	});
+}
+
+void ofxDmxUsbPro::startThread(float frameRate) {
+	if (threadOutput || frameRate < 0)
+		return;
+	threadFrameRate = frameRate;
+	// Make sure the thread starts out with the current universe
+	ofScopedLock lock(dmxMutex);
+	if (dmxLength > 0) {
+		dmxDirtyLow = 0;
+		dmxDirtyHigh = dmxLength;
+	}
+	threadOutput = true;
+	if (!ofThread::isThreadRunning())
+		ofThread::startThread();
+}
+
+void ofxDmxUsbPro::stopThread() {
+	threadOutput = false;
+	if (!threadInput && ofThread::isThreadRunning())
+		waitForThread(true);
+}
+
+bool ofxDmxUsbPro::isThreadRunning() {
+	return threadOutput;
+}
+
+void ofxDmxUsbPro::startBridge(ofxDmxUsbPro & output, const DmxPatch & patch) {
+	if (!serial.isInitialized())
+		return;
+	stopBridge();
+	{
+		ofScopedLock lock(bridgeMutex);
+		bridgeTarget = &output;
+		bridgePatch = patch;
+		bridgeDueMicros = 0;
+	}
+	bridgeParser.clear();
+	memset(bridgeInput, 0, sizeof(bridgeInput));
+	// Bytes already read stay in parser for update()
+	{
+		std::lock_guard<std::mutex> lock(inputMutex);
+		inputSeen = inputSequence;
+		threadInput = true;
+	}
+	if (!ofThread::isThreadRunning())
+		ofThread::startThread();
+}
+
+void ofxDmxUsbPro::stopBridge() {
+	if (!threadInput)
+		return;
+	{
+		// Waits for the thread to finish the read in progress, after that the
+		// app reads the serial port again
+		std::lock_guard<std::mutex> lock(inputMutex);
+		threadInput = false;
+	}
+	inputCondition.notify_all();
+	if (!threadOutput && ofThread::isThreadRunning())
+		waitForThread(true);
+	ofScopedLock lock(bridgeMutex);
+	bridgeTarget = nullptr;
+}
+
+bool ofxDmxUsbPro::isBridgeRunning() {
+	return threadInput;
+}
+
+void ofxDmxUsbPro::setBridgePatch(const DmxPatch & patch) {
+	ofScopedLock lock(bridgeMutex);
+	bridgePatch = patch;
+}
+
+DmxUsbProHistogram ofxDmxUsbPro::getBridgeLatency() {
+	ofScopedLock lock(bridgeMutex);
+	return bridgeLatency;
+}
+
+void ofxDmxUsbPro::resetBridgeLatency() {
+	ofScopedLock lock(bridgeMutex);
+	bridgeLatency.clear();
+}
+
+void ofxDmxUsbPro::readInput() {
+	std::unique_lock<std::mutex> lock(inputMutex);
+	if (!threadInput)
+		return;
+	uint8_t buffer[DMX_USB_PRO_RING_SIZE];
+	int n = serial.available();
+	if (n <= 0)
+		return;
+	int r = serial.readBytes(buffer, MIN((size_t)n, sizeof(buffer)));
+	if (r <= 0)
+		return;
+	uint64_t now = ofGetElapsedTimeMicros();
+
+	// The bridge goes first, the app is a whole frame behind anyway
+	bridgeParser.write(buffer, r);
+	while (bridgeParser.next(bridgeReceived))
+		bridgeMessage(bridgeReceived, now);
+
+	if (parser.write(buffer, r) < (size_t)r)
+		ofLogWarning("ofxDmxUsbPro") << "Input dropped, update() is not keeping up";
+	inputSequence++;
+	lock.unlock();
+	inputCondition.notify_all();
+}
+
+void ofxDmxUsbPro::bridgeMessage(DmxUsbProPacket & packet, uint64_t receivedMicros) {
+	uint64_t changed[8];
+	if (packet.label == LABEL_PACKET_RECEIVED && packet.length >= 2 && packet.data[1] == 0)
+		DmxUsbProApplyFrame(packet.data + 2, packet.length - 2, bridgeInput, changed);
+	else if (packet.label == LABEL_DMX_CHANGED && packet.length >= 6)
+		DmxUsbProDecodeChanges(packet.data, packet.length, bridgeInput, changed);
+	else
+		return;
+
+	ofScopedLock lock(bridgeMutex);
+	size_t length = bridgePatch.getLength();
+	if (bridgeTarget == nullptr || length == 0)
+		return;
+	bridgePatch.apply(bridgeInput, bridgeOutput);
+	bridgeTarget->sendDmx(bridgeOutput, length);
+	flushBridge(bridgeDueMicros > 0 ? bridgeHeldMicros : receivedMicros);
+}
+
+void ofxDmxUsbPro::updateBridge() {
+	std::lock_guard<std::mutex> inputLock(inputMutex);
+	ofScopedLock lock(bridgeMutex);
+	if (threadInput && bridgeTarget != nullptr)
+		flushBridge(bridgeHeldMicros);
+}
+
+void ofxDmxUsbPro::flushBridge(uint64_t receivedMicros) {
+	ofxDmxUsbPro & target = *bridgeTarget;
+	target.flushDmx();
+
+	ofScopedLock lock(target.dmxMutex);
+	if (target.dmxDirtyLow < target.dmxDirtyHigh && !target.threadOutput) {
+		// The widget is still busy with the previous frame
+		bridgeHeldMicros = receivedMicros;
+		bridgeDueMicros = target.dmxLastSendMicros + target.getDmxOutputMicros(target.dmxLength);
+	}
+	else {
+		bridgeDueMicros = 0;
+		bridgeLatency.add(ofGetElapsedTimeMicros() - receivedMicros);
+	}
+}
+
+void ofxDmxUsbPro::threadedFunction() {
+	typedef std::chrono::steady_clock clock;
+	clock::duration keepAlive = std::chrono::milliseconds(dmxKeepAliveMillis);
+	clock::time_point next = clock::now();
+	clock::time_point lastSend = next;
+
+	while (ofThread::isThreadRunning()) {
+		if (threadOutput) {
+			// Send the latest frame published by flushDmx(), or repeat the
+			// last one when the keep-alive interval has passed
+			bool send = false;
+			if (dmxFading) {
+				// Fades are worked out for the frame about to go out, which
+				// then has everything set up to now
+				ofScopedLock lock(dmxMutex);
+				updateDmxFades(ofGetElapsedTimeMicros());
+				if (dmxDirtyLow < dmxDirtyHigh) {
+					if (frameSwap.load() & FRAME_NEW)
+						frameBack = frameSwap.exchange(frameBack) & FRAME_INDEX;
+					writeDmxFrame(frames[frameBack]);
+					dmxDirtyLow = 512;
+					dmxDirtyHigh = 0;
+					send = true;
+				}
+			}
+			if (!send && (frameSwap.load() & FRAME_NEW)) {
+				frameBack = frameSwap.exchange(frameBack) & FRAME_INDEX;
+				send = true;
+			}
+			else if (!send && dmxKeepAliveMillis > 0 && next - lastSend >= keepAlive) {
+				send = true;
+			}
+
+			DmxFrame & frame = frames[frameBack];
+			if (send && frame.size > 0) {
+				clock::time_point now = clock::now();
+				writeBytes(frame.packet, frame.size);
+				lastSend = next;
+				if (statsEnabled) {
+					ofScopedLock lock(mutex);
+					stats.frameJitter.add(std::chrono::duration_cast<std::chrono::microseconds>(now > next ? now - next : next - now).count());
+				}
+			}
+
+			// Next frame once the widget has put this one on the line, but
+			// never burst to catch up
+			size_t channels = frame.size > 6 ? frame.size - 6 : 0;
+			next += std::chrono::microseconds(getDmxOutputMicros(channels));
+		}
+		else {
+			// Only the bridge, look at the flags now and then
+			next = clock::now() + std::chrono::milliseconds(10);
+		}
+		clock::time_point now = clock::now();
+		if (next < now)
+			next = now;
+
+		if (threadInput) {
+			// Handle input as it arrives until the next frame is due
+			while (threadInput && (now = clock::now()) < next) {
+				uint64_t wait = std::chrono::duration_cast<std::chrono::microseconds>(next - now).count();
+				uint64_t due = bridgeDueMicros;
+				if (due > 0) {
+					uint64_t time = ofGetElapsedTimeMicros();
+					if (due <= time) {
+						updateBridge();
+						continue;
+					}
+					wait = MIN(wait, due - time);
+				}
+				if (serial.waitForData(wait))
+					readInput();
+			}
+		}
+		else {
+			std::this_thread::sleep_until(next);
 		}
 	}
-	return 0;
+}
+
+ofxDmxUsbPro::RdmDiscoveryResult ofxDmxUsbPro::waitForDiscovery(RdmUid & uid) {
+	// The widget answers a discovery request with a single packet, so an empty
+	// branch costs one short timeout and anything else returns right away
+	uint64_t start = ofGetElapsedTimeMicros();
+	uint64_t time = 0;
+	while (time < rdmDiscoveryTimeoutMicros) {
+		if (!waitForReply(LABEL_PACKET_RECEIVED, 0, rdmDiscoveryTimeoutMicros - time))
+			return RDM_DISCOVERY_NONE;
+
+		uint8_t * data = getData();
+		uint16_t length = getLength();
+		// Only a response to the branch, or a status error from several
+		// devices answering at once, counts. A response that does not decode
+		// means a collision as well.
+		if (length >= 2 && (data[0] != 0 || data[1] == 0xFE || data[1] == 0xAA)) {
+			if (data[0] != 0 || !RdmDecodeUid(data + 1, length - 1, uid))
+				return RDM_DISCOVERY_COLLISION;
+			return RDM_DISCOVERY_FOUND;
+		}
+		// DMX input or a late reply for the transaction engine
+		processMessage();
+		time = ofGetElapsedTimeMicros() - start;
+	}
+	return RDM_DISCOVERY_NONE;
 }
 
 bool ofxDmxUsbPro::waitForReply(uint8_t label, size_t length, uint64_t timeOutMicros) {
@@ -348,13 +1483,24 @@ bool ofxDmxUsbPro::waitForReply(uint8_t label, size_t length, uint64_t timeOutMi
 		return false;
 	uint64_t now = ofGetElapsedTimeMicros();
 	uint64_t time = 0;
-	size_t n = receiveMessage();
-	while (n < length && time < timeOutMicros) {
-		ofSleepMillis(1);
-		n = receiveMessage();
-		if (n > 0 && message[1] != label)
-			n = 0;
+	while (time < timeOutMicros) {
+		receiveMessage();
+		while (parser.next(received)) {
+			if (received.label == label && received.length >= length) {
+				if (statsEnabled)
+					stats.waitDuration.add(ofGetElapsedTimeMicros() - now);
+				return true;
+			}
+			// Anything else is handled as if it arrived during update()
+			processMessage();
+		}
+		time = ofGetElapsedTimeMicros() - now;
+		if (time < timeOutMicros)
+			waitForInput(timeOutMicros - time);
 		time = ofGetElapsedTimeMicros() - now;
 	}
-	return n >= length;
+	if (statsEnabled)
+		stats.waitDuration.add(time);
+	received.length = 0;
+	return false;
 }
@@ -2,10 +2,24 @@
 
 #include "ofMain.h"
 #include "Rdm.h"
+#include "DmxUsbProParser.h"
+#include "DmxUsbProStats.h"
+#include "DmxUsbProSerial.h"
+#include "DmxUsbProQueue.h"
+#include "RdmBatch.h"
+#include "RdmDeviceCache.h"
+#include "DmxPatch.h"
+#include "DmxTransform.h"
+#include "DmxFader.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
 
-class ofxDmxUsbPro {
+class ofxDmxUsbPro : protected ofThread {
 public:
 	ofxDmxUsbPro();
+	~ofxDmxUsbPro();
 
 	void listDevices();
 	vector <ofSerialDeviceInfo> getDeviceList();
@@ -13,6 +27,9 @@ public:
 
 	bool setup(int deviceNumber = 0);
 	bool setup(string portName);
+	void close();
+	bool isConnected();
+	string getPortName();
 
 	void update();
 
@@ -21,7 +38,18 @@ public:
 	void requestWidgetParameters();
 	void setWidgetParameters(uint8_t breakTime = 9, uint8_t mabTime = 1, uint8_t refreshRate = 40);
 	void requestSerialNumber();
+	// sendDmx() merges the channels into the output universe, which keeps its
+	// values between calls. Unless batching is on, the universe is written
+	// right away, except while the widget is still sending the previous frame.
+	// Changes held back then, and all changes while batching, go out with the
+	// next flushDmx() or update(). With the output thread or a pool, sending
+	// is left to them.
 	void sendDmx(uint8_t * dmx, size_t length, uint16_t channel = 0);
+	void flushDmx();
+	// Batching collects several partial sendDmx() calls into one frame
+	void setDmxBatching(bool batching);
+	bool getDmxBatching();
+	void setDmxKeepAlive(uint64_t millis);
 	void sendRdm(uint8_t * rdm, size_t length);
 	void sendRdm(RdmMessage & rdm);
 	void setReceiveDmxOnChange(bool dmxChangeOnly);
@@ -36,8 +64,104 @@ public:
 	RdmUid getUid();
 	bool getRdm(RdmMessage & send, RdmMessage & reply);
 	bool getRdm(RdmUid & uid, uint16_t pid, RdmMessage & reply);
+	// Also works for responses sent in several ACK_OVERFLOW parts
+	bool getRdm(RdmUid & uid, uint16_t pid, vector<uint8_t> & data);
 	bool getRdmDiscovery(const RdmUid & from, const RdmUid & to, vector<RdmUid> & deviceUids);
 	bool getRdmDiscoveryFull(vector<RdmUid> & deviceUids);
+	void setRdmDiscoveryTimeout(uint64_t timeOutMicros);
+
+	// Asynchronous RDM
+	// Requests are queued and sent back to back as soon as the previous reply
+	// or timeout is in. Replies are matched by transaction number and PID.
+	// ACK_OVERFLOW parts are collected into RdmTransaction::data, and replies
+	// delayed with ACK_TIMER are fetched with QUEUED_MESSAGE when due.
+	// Callbacks and futures complete from update().
+
+	uint32_t sendRdmAsync(RdmMessage & rdm, RdmCallback callback = nullptr);
+	std::future<RdmTransaction> getRdmAsync(RdmMessage & rdm);
+	std::future<RdmTransaction> getRdmAsync(const RdmUid & uid, uint16_t pid);
+	void cancelRdm(uint32_t id);
+	void cancelAllRdm();
+	size_t getNumRdmPending();
+	void setRdmTimeout(uint64_t timeOutMicros);
+	void setRdmRetries(uint8_t retries);
+	void setRdmMaxInFlight(size_t maxInFlight);
+
+	// Batches
+	// Requests of a batch are fed to the transaction engine as the line frees
+	// up. The connection keeps the batch alive until it is done or cancelled.
+
+	void sendRdmBatch(shared_ptr<RdmBatch> batch);
+	bool getRdmBatch(RdmBatch & batch);
+
+	// Device cache
+	// While enabled, GET requests for cached PIDs are answered from the cache
+	// without going on the line, and every reply received updates it.
+
+	void setRdmCacheEnabled(bool enabled);
+	bool getRdmCacheEnabled();
+	RdmDeviceCache & getRdmCache();
+
+	// Statistics
+	// Counters are only updated while enabled. getStats() returns a copy and
+	// the per second rates cover the time since the previous call.
+
+	void setStatsEnabled(bool enabled);
+	bool getStatsEnabled();
+	DmxUsbProStats getStats();
+	void resetStats();
+
+	// Output timing
+	// Frames are never sent faster than the widget can put them on the line,
+	// given the break, mark after break and refresh rate in widgetParameters
+	// and the length of the universe. Changes made in between are merged
+	// into the next frame.
+
+	uint64_t getDmxFrameMicros(size_t channels);
+	float getDmxFrameRate();
+
+	// Output transform
+	// Every frame goes through the response curves and 16-bit pairs of the
+	// transform on its way to the widget, the universe set with sendDmx()
+	// keeps the values as given. sendDmx16() sets 16-bit values on pairs of
+	// channels, coarse first.
+
+	void setDmxTransform(const DmxTransform & transform);
+	DmxTransform getDmxTransform();
+	void sendDmx16(const uint16_t * values, size_t count, uint16_t channel = 0);
+
+	// Fades
+	// fadeDmx() sets values the output reaches after fadeMillis. The steps in
+	// between are computed for every frame as it is sent, by the output thread
+	// when it runs, so fades are as smooth as the output rate allows whatever
+	// the app's frame rate. sendDmx() ends fades on the channels it sets.
+
+	void fadeDmx(uint8_t * dmx, size_t length, uint64_t fadeMillis, uint16_t channel = 0);
+	bool isDmxFading();
+
+	// Threaded output
+	// While running, flushDmx() only publishes the universe and the thread
+	// streams it to the widget at frameRate, or at the rate the widget can
+	// sustain when that is lower or frameRate is 0.
+
+	void startThread(float frameRate = 0);
+	void stopThread();
+	bool isThreadRunning();
+
+	// Bridge
+	// The I/O thread reads the serial port, patches every DMX frame received
+	// and sends it to output right away, which may be this widget or another
+	// one. The app side sees the same packets and events from update() as
+	// without the bridge. Latency runs from reading the frame until it has
+	// been written to the output widget. An output running its own thread
+	// sends the frame in its next slot instead of right away.
+
+	void startBridge(ofxDmxUsbPro & output, const DmxPatch & patch);
+	void stopBridge();
+	bool isBridgeRunning();
+	void setBridgePatch(const DmxPatch & patch);
+	DmxUsbProHistogram getBridgeLatency();
+	void resetBridgeLatency();
 
 	struct {
 		unsigned char FirmwareLSB;
@@ -54,23 +178,187 @@ public:
 		size_t		size;
 	} DmxData;
 
+	// Received universe plus a mask with one bit per channel that changed
+	// since the previous frame, channel n is bit n % 64 of changed[n / 64]
+	typedef struct {
+		uint8_t *	data;
+		size_t		size;
+		uint64_t	changed[8];
+		size_t		count;
+	} DmxChangedData;
+
 	ofEvent<DmxData> dmxReceived;
+	ofEvent<DmxChangedData> dmxChanged;
 	ofEvent<RdmMessage> rdmReceived;
 	ofEvent<RdmUid> rdmDiscovered;
 
 protected:
+	friend class DmxUsbProPool;
+	friend class DmxPlayer;
+
+	// Complete LABEL_SEND_DMX packet including start code, header and end code
+	typedef struct {
+		uint8_t		packet[4 + 513 + 1];
+		size_t		size;
+	} DmxFrame;
 
 	bool init();
-	uint8_t * prepareMessage(uint8_t label, size_t length);
 	uint8_t getLabel();
 	uint8_t * getData();
 	uint16_t getLength();
-	void sendMessage();
 	int receiveMessage();
+	bool waitForInput(uint64_t timeOutMicros);
+	void readInput();
+	void bridgeMessage(DmxUsbProPacket & packet, uint64_t receivedMicros);
+	void updateBridge();
+	void flushBridge(uint64_t receivedMicros);
+	void processMessage();
 	bool waitForReply(uint8_t label, size_t length = 0, uint64_t timeOutMicros = 1000000);
+	bool waitForRdm(RdmMessage & send, RdmTransaction & transaction, uint64_t timeOutMicros = 0);
+	uint64_t getRdmWaitMicros();
+	void writePacket(uint8_t label, const uint8_t * data, size_t length);
+	void writeBytes(const uint8_t * bytes, size_t size);
+	void submit(DmxUsbProCommand & command);
+	void writeCommands();
+	void writeBatch(DmxUsbProCommand ** batch, size_t count);
+	uint64_t writeFrame(const DmxFrame & frame);
+	void lockWriter();
+	void unlockWriter();
+	void notifyWriters();
+	void writeDmxFrame(DmxFrame & frame);
+	uint64_t getDmxOutputMicros(size_t channels);
+	void updateDmxTiming();
+	void updateDmxFades(uint64_t micros);
+	// Time from which flushDmx() sends rather than holds back a frame, 0 when
+	// it would send right away
+	uint64_t getDmxReadyMicros();
+	bool takeDmxFrame(DmxFrame & frame, uint64_t micros);
+	void threadedFunction();
+
+	typedef enum {
+		RDM_DISCOVERY_NONE,
+		RDM_DISCOVERY_FOUND,
+		RDM_DISCOVERY_COLLISION
+	} RdmDiscoveryResult;
+
+	RdmDiscoveryResult waitForDiscovery(RdmUid & uid);
+
+	typedef struct {
+		RdmTransaction	transaction;
+		RdmCallback		callback;
+		uint64_t		sentMicros;
+		uint64_t		startMicros;
+		uint64_t		dueMicros;			// When to poll for a queued reply
+		uint8_t			transactionNumber;	// Of the last packet sent
+		uint8_t			tries;				// Attempts at the current packet
+		uint8_t			polls;
+		bool			queued;				// Polling with QUEUED_MESSAGE
+		uint64_t		timeoutMicros;		// 0 for rdmTimeoutMicros
+	} RdmPending;
+
+	uint32_t queueRdm(RdmMessage & rdm, RdmCallback callback, uint64_t timeOutMicros = 0);
+	uint64_t getRdmTimeout(const RdmPending & pending);
+	void pollRdm();
+	void updateRdm();
+	void updateRdmBatches();
+	void transmitRdm(RdmPending & pending);
+	void waitRdm(RdmPending & pending, uint64_t micros);
+	bool matchRdm(const RdmMessageView & reply);
+	void finishRdm(RdmPending & pending, RdmStatus status);
 
-	ofSerial serial;
-	vector<unsigned char> message;
-	vector<unsigned char> cosData;
+	DmxUsbProSerial serial;
+	string portName;
+	DmxUsbProParser parser;
+	DmxUsbProPacket received;
+	uint8_t dmxInput[512];
+	size_t dmxInputSize;
 	uint8_t rdmTransactionNumber;
+
+	deque<RdmPending> rdmQueue;
+	vector<RdmPending> rdmInFlight;
+	vector<RdmPending> rdmWaiting;
+	uint32_t rdmNextId;
+	uint64_t rdmTimeoutMicros;
+	uint8_t rdmRetries;
+	size_t rdmMaxInFlight;
+	uint64_t rdmDiscoveryTimeoutMicros;
+	vector<shared_ptr<RdmBatch>> rdmBatches;
+	bool rdmCacheEnabled;
+	RdmDeviceCache rdmCache;
+
+	// Triple buffer shared with the output thread. frameFront is owned by the
+	// app, frameBack by the thread and frameSwap holds the index of the spare
+	// frame plus FRAME_NEW when it contains a frame the thread has not sent yet.
+	DmxFrame frames[3];
+	uint8_t frameFront;
+	uint8_t frameBack;
+	std::atomic<uint8_t> frameSwap;
+	float threadFrameRate;
+	// The I/O thread runs while either the output or the bridge needs it
+	std::atomic<bool> threadOutput;
+	std::atomic<bool> threadInput;
+
+	// While the bridge runs, only the thread reads the serial port. It passes
+	// every byte on to parser, inputMutex is held while it reads and waiting
+	// functions wake up on inputCondition.
+	std::mutex inputMutex;
+	std::condition_variable inputCondition;
+	uint64_t inputSequence;
+	uint64_t inputSeen;
+	DmxUsbProParser bridgeParser;
+	DmxUsbProPacket bridgeReceived;
+	uint8_t bridgeInput[512];
+	uint8_t bridgeOutput[512];
+	// Guards the patch, target and latency
+	ofMutex bridgeMutex;
+	ofxDmxUsbPro * bridgeTarget;
+	DmxPatch bridgePatch;
+	DmxUsbProHistogram bridgeLatency;
+	// A frame held back by the output rate, sent by the thread when due
+	std::atomic<uint64_t> bridgeDueMicros;
+	uint64_t bridgeHeldMicros;
+
+	// Output universe. sendDmx() merges into it, flushDmx() turns it into a
+	// frame covering the channels up to dmxLength. Both may be called from
+	// other threads than update(), dmxMutex keeps them consistent.
+	ofMutex dmxMutex;
+	uint8_t dmxUniverse[512];
+	uint16_t dmxLength;
+	uint16_t dmxDirtyLow;
+	uint16_t dmxDirtyHigh;
+	uint64_t dmxKeepAliveMillis;
+	bool dmxBatching;
+	uint64_t dmxLastSendMicros;
+	DmxTransform dmxTransform;
+	DmxFader dmxFader;
+	std::atomic<bool> dmxFading;
+	// Frames are taken by a DmxUsbProPool instead of flushDmx()
+	std::atomic<bool> dmxPooled;
+	uint8_t dmxTransformed[512];
+
+	// Wire timing from widgetParameters, read by the output thread
+	std::atomic<uint32_t> dmxBreakMicros;
+	std::atomic<uint32_t> dmxMabMicros;
+	std::atomic<uint8_t> dmxRefreshRate;
+
+	// Outbound packets from any thread. The thread holding writing writes
+	// them, writeRequests tells it whether more arrived while it did. A
+	// submitting thread waits until its packet is written, spinning briefly
+	// and then on writeCondition.
+	DmxUsbProQueue commands;
+	std::atomic_flag writing;
+	std::atomic<uint64_t> writeRequests;
+	std::atomic<int> writeWaiters;
+	std::mutex writeMutex;
+	std::condition_variable writeCondition;
+
+	// Fields written by writeBatch() and the output thread are protected by
+	// mutex, everything else is only touched from the app thread
+	std::atomic<bool> statsEnabled;
+	DmxUsbProStats stats;
+	uint64_t statsResyncOffset;
+	uint64_t statsLastMicros;
+	uint64_t statsLastFramesSent;
+	uint64_t statsLastFramesReceived;
+	uint64_t statsLastFrameMicros;
 };
\ No newline at end of file